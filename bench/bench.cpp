@@ -0,0 +1,660 @@
+// Benchmarks for the hot paths of the server: frame assembly (server_thread), the decode loop
+// (handle_new_frame_msg -> render_frame), the quad transform, timeline queries and, when built
+// with BENCH_CAIRO, rendering with cairo, exporting frames and loading the font.
+//
+// Every benchmark prints one json object per line. --baseline compares the fastest run of each
+// against an earlier run, and exits with 1 if anything got slower than the threshold allows.
+
+#include "stdafx.h"
+#include "log_messages.hpp"
+#include "frame_decoder.hpp"
+#include "frame_assembler.hpp"
+#include "frame_store.hpp"
+#include "frame_validator.hpp"
+#include "quad_transform.hpp"
+#include "timeline.hpp"
+#include "decoded_frame.hpp"
+#include "file_utils.hpp"
+#include "string_utils.hpp"
+#ifdef BENCH_CAIRO
+#include "frame_renderer.hpp"
+#include "frame_exporter.hpp"
+#include "surface.hpp"
+#include "font.hpp"
+#include "cairo/include/cairo/cairo.h"
+#endif
+
+#include <algorithm>
+#include <functional>
+#include <map>
+
+using namespace std;
+
+namespace {
+
+	const int kWidth = 1280;
+	const int kHeight = 720;
+
+	// a received message, as it comes out of zmq
+	typedef vector<uint8> Message;
+
+	struct Workload {
+		const char *name;
+		vector<Message> messages;
+		uint32 num_frames;
+		uint64_t num_quads;
+	};
+
+	struct Result {
+		string name;
+		double median_ms;
+		double min_ms;
+		double items_per_sec;
+		double mb_per_sec;
+	};
+
+	struct Options {
+		Options() : reps(7), threshold(0.25), font("../lucida_console_16.fnt"), write_baseline(false) {}
+		int reps;
+		double threshold;
+		string font;
+		string out;
+		string baseline;
+		string filter;
+		bool write_baseline;
+	};
+
+	// deterministic, so every run sees the same frames
+	struct Random {
+		Random() : state(0x12345678) {}
+		uint32 next() {
+			state = state * 1664525 + 1013904223;
+			return state >> 8;
+		}
+		uint32 next(uint32 n) { return next() % n; }
+		uint32 state;
+	};
+
+	template <class T>
+	void add_msg(vector<Message> *messages, const T &t) {
+		messages->push_back(Message(sizeof(T)));
+		new(&messages->back()[0])T(t);
+	}
+
+	void add_quads(vector<Message> *messages, const vector<log_msg::Quad> &quads, uint32_t tag) {
+		messages->push_back(Message(sizeof(log_msg::DrawQuads) + quads.size() * sizeof(log_msg::Quad)));
+		uint8 *buf = &messages->back()[0];
+		new(buf)log_msg::DrawQuads((int)quads.size(), tag);
+		memcpy(buf + sizeof(log_msg::DrawQuads), &quads[0], quads.size() * sizeof(log_msg::Quad));
+	}
+
+	// batch_size quads per message, colors from a palette of num_colors (1 per quad if 0).
+	// with nesting > 0, nested frames that deep are sent between some of the batches
+	void add_frame(vector<Message> *messages, Random *rnd, uint32 num_quads, uint32 batch_size,
+		int min_size, int max_size, uint32 num_colors, uint32 nesting) {
+
+		add_msg(messages, log_msg::BeginFrame());
+		add_msg(messages, log_msg::SetupWindow(kWidth, kHeight));
+
+		vector<log_msg::Quad> quads;
+		uint32 color = 0xff0000ff;
+		uint32 batch = 0;
+		for (uint32 i = 0; i < num_quads; ++i) {
+			if (num_colors == 0 || i % (num_quads / num_colors + 1) == 0)
+				color = (rnd->next() << 8) | 0xff;
+
+			const int w = min_size + (int)rnd->next(max_size - min_size + 1);
+			const int h = min_size + (int)rnd->next(max_size - min_size + 1);
+			quads.push_back(log_msg::Quad(rnd->next(kWidth - w + 1), rnd->next(kHeight - h + 1), w, h, color));
+			if (quads.size() < batch_size && i != num_quads - 1)
+				continue;
+
+			add_quads(messages, quads, batch++ % 4);
+			quads.clear();
+			if (nesting > 0 && rnd->next(4) == 0) {
+				for (uint32 j = 0; j < nesting; ++j)
+					add_msg(messages, log_msg::BeginFrame());
+				add_quads(messages, vector<log_msg::Quad>(16, log_msg::Quad(0, 0, 8, 8, 0xffffffff)), 0);
+				for (uint32 j = 0; j < nesting; ++j)
+					add_msg(messages, log_msg::EndFrame());
+			}
+		}
+
+		add_msg(messages, log_msg::EndFrame());
+	}
+
+	// the benchmarks bench_workload runs, each as <name>/<workload>. the ones that need the workload
+	// assembled into a store first are separate, so that can be skipped
+	const char * const kAssembleBenchmarks[] = { "assemble", "assemble_validated", "validate", "assemble_spill" };
+	const char * const kDecodeBenchmarks[] = {
+		"decode", "decode_masked", "decode_shared", "decode_shared_masked",
+#ifdef BENCH_CAIRO
+		"render", "surfaces4", "export",
+#endif
+	};
+	const size_t kNumAssembleBenchmarks = sizeof(kAssembleBenchmarks) / sizeof(kAssembleBenchmarks[0]);
+	const size_t kNumDecodeBenchmarks = sizeof(kDecodeBenchmarks) / sizeof(kDecodeBenchmarks[0]);
+
+	// a benchmark runs if its name contains the filter
+	bool selected(const Options &options, const string &name) {
+		return options.filter.empty() || name.find(options.filter) != string::npos;
+	}
+
+	// whether any of names (with suffix) is selected, so setup can be skipped when none is
+	bool any_selected(const Options &options, const char * const *names, size_t count, const string &suffix = string()) {
+		for (size_t i = 0; i < count; ++i) {
+			if (selected(options, names[i] + suffix))
+				return true;
+		}
+		return false;
+	}
+
+	// only the workloads that some selected benchmark runs on
+	void make_workloads(const Options &options, vector<Workload> *workloads) {
+		struct Spec {
+			const char *name;
+			uint32 frames, quads, batch_size;
+			int min_size, max_size;
+			uint32 colors, nesting;
+		} specs[] = {
+			{ "large_quads",  64,        64,   16, 200, 600,   8, 0 },
+			{ "tiny_quads",    2, 1000000, 4096,   1,   2,  16, 0 },
+			{ "color_churn",  16,   50000, 1024,   2,  16,   0, 0 },
+			{ "nested_frames",64,   10000,  256,   2,  32,  64, 2 },
+		};
+
+		for (size_t i = 0; i < sizeof(specs) / sizeof(specs[0]); ++i) {
+			const Spec &s = specs[i];
+			const string suffix = string("/") + s.name;
+			if (!any_selected(options, kAssembleBenchmarks, kNumAssembleBenchmarks, suffix) &&
+				!any_selected(options, kDecodeBenchmarks, kNumDecodeBenchmarks, suffix))
+				continue;
+
+			Random rnd;
+			Workload w;
+			w.name = s.name;
+			w.num_frames = s.frames;
+			w.num_quads = (uint64_t)s.frames * s.quads;
+			for (uint32 j = 0; j < s.frames; ++j)
+				add_frame(&w.messages, &rnd, s.quads, s.batch_size, s.min_size, s.max_size, s.colors, s.nesting);
+			workloads->push_back(w);
+		}
+	}
+
+	double now_ms() {
+#ifdef _WIN32
+		LARGE_INTEGER now, freq;
+		QueryPerformanceCounter(&now);
+		QueryPerformanceFrequency(&freq);
+		return 1000.0 * now.QuadPart / freq.QuadPart;
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+#endif
+	}
+
+	// times reps samples of fn (after one warmup run), and reports the median time per call.
+	// short benchmarks call fn several times per sample so timer and scheduler noise averages out
+	Result measure(const string &name, int reps, double items, double bytes, const function<void()> &fn) {
+		const double kMinSampleMs = 20;
+		double start = now_ms();
+		fn();
+		const double warmup = now_ms() - start;
+		const int calls = warmup >= kMinSampleMs ? 1 : (int)min(1000.0, kMinSampleMs / max(warmup, 0.001)) + 1;
+
+		vector<double> times;
+		for (int i = 0; i < reps; ++i) {
+			start = now_ms();
+			for (int j = 0; j < calls; ++j)
+				fn();
+			times.push_back((now_ms() - start) / calls);
+		}
+		sort(times.begin(), times.end());
+
+		Result r;
+		r.name = name;
+		r.median_ms = times[times.size() / 2];
+		r.min_ms = times[0];
+		r.items_per_sec = r.median_ms > 0 ? items / (r.median_ms / 1000) : 0;
+		r.mb_per_sec = r.median_ms > 0 ? bytes / (1024 * 1024) / (r.median_ms / 1000) : 0;
+		return r;
+	}
+
+	// measures fn, unless the filter leaves it out
+	void run(const Options &options, vector<Result> *results, const string &name, int reps, double items, double bytes,
+		const function<void()> &fn) {
+		if (selected(options, name))
+			results->push_back(measure(name, reps, items, bytes, fn));
+	}
+
+	// does what the cairo renderer does, minus cairo, so the decode loop and the transform
+	// are measured on their own
+	struct CountingVisitor {
+		CountingVisitor() : fills(0), rects(0), sum(0), prev_color(0) {}
+
+		void setup_window(const log_msg::SetupWindow *s) {
+			xf.sx = (float)kWidth / s->width;
+			xf.sy = (float)kHeight / s->height;
+		}
+
+		void quads(const log_msg::DrawQuads *q) {
+			transform_quads(q, xf, &scratch);
+			for (uint32_t i = 0; i < scratch.count; ++i) {
+				if (scratch.color[i] != prev_color) {
+					prev_color = scratch.color[i];
+					fills++;
+				}
+				sum += scratch.x[i] + scratch.y[i] + scratch.w[i] + scratch.h[i];
+				rects++;
+			}
+		}
+
+		ViewTransform xf;
+		QuadBatch scratch;
+		uint64_t fills;
+		uint64_t rects;
+		double sum;
+		uint32_t prev_color;
+	};
+
+	// assembles the workload into a store, so the other benchmarks can work on real frames.
+	// with validate, every message is checked first like server_thread does
+	void assemble(const Workload &w, FrameStore *store, bool validate) {
+		FrameAssembler assembler(store);
+		for (size_t i = 0; i < w.messages.size(); ++i) {
+			const Message &m = w.messages[i];
+			if (validate && !validate_message(&m[0], m.size()))
+				continue;
+			uint32 frame;
+			assembler.add((const log_msg::Base *)&m[0], m.size(), &frame);
+		}
+	}
+
+	size_t workload_bytes(const Workload &w) {
+		size_t bytes = 0;
+		for (size_t i = 0; i < w.messages.size(); ++i)
+			bytes += w.messages[i].size();
+		return bytes;
+	}
+
+	void bench_workload(const Workload &w, const Options &options, vector<Result> *results) {
+		const string suffix = string("/") + w.name;
+		const double bytes = (double)workload_bytes(w);
+
+		// receive side: messages -> slabs, with everything kept in memory
+		run(options, results, "assemble" + suffix, options.reps, w.num_frames, bytes, [&]() {
+			FrameStore store;
+			FrameStore::Config config;
+			config.memory_budget = ~(size_t)0 >> 1;
+			store.init(config);
+			assemble(w, &store, false);
+		});
+
+		// the same with validation, which is what the server does. the difference is the whole cost of it
+		run(options, results, "assemble_validated" + suffix, options.reps, w.num_frames, bytes, [&]() {
+			FrameStore store;
+			FrameStore::Config config;
+			config.memory_budget = ~(size_t)0 >> 1;
+			store.init(config);
+			assemble(w, &store, true);
+		});
+
+		run(options, results, "validate" + suffix, options.reps, (double)w.messages.size(), bytes, [&]() {
+			uint32 valid = 0;
+			for (size_t i = 0; i < w.messages.size(); ++i)
+				valid += validate_message(&w.messages[i][0], w.messages[i].size());
+			if (valid != w.messages.size())
+				fprintf(stderr, "%s: %u messages didn't validate\n", w.name, (uint32)w.messages.size() - valid);
+		});
+
+		// same again, with a budget small enough that old slabs get spilled while we go
+		run(options, results, "assemble_spill" + suffix, options.reps, w.num_frames, bytes, [&]() {
+			FrameStore store;
+			FrameStore::Config config;
+			config.slab_size = 1024 * 1024;
+			config.memory_budget = 4 * 1024 * 1024;
+			store.init(config);
+			assemble(w, &store, false);
+		});
+
+		if (!any_selected(options, kDecodeBenchmarks, kNumDecodeBenchmarks, suffix))
+			return;
+
+		FrameStore store;
+		store.init(FrameStore::Config());
+		assemble(w, &store, true);
+		const uint32 num_frames = store.num_frames();
+
+		run(options, results, "decode" + suffix, options.reps, (double)w.num_quads, bytes, [&]() {
+			CountingVisitor v;
+			for (uint32 i = 0; i < num_frames; ++i) {
+				const uint8 *start, *end;
+				if (store.acquire(i, &start, &end)) {
+					decode_frame(start, end, ~0u, v);
+					store.release(i);
+				}
+			}
+		});
+
+		// half the tags off, which should cost next to nothing for the hidden half
+		run(options, results, "decode_masked" + suffix, options.reps, (double)w.num_quads, bytes, [&]() {
+			CountingVisitor v;
+			for (uint32 i = 0; i < num_frames; ++i) {
+				const uint8 *start, *end;
+				if (store.acquire(i, &start, &end)) {
+					decode_frame(start, end, 0x3, v);
+					store.release(i);
+				}
+			}
+		});
+
+		// the shared decode the surfaces draw from
+		DecodedFrame decoded;
+		run(options, results, "decode_shared" + suffix, options.reps, (double)w.num_quads, bytes, [&]() {
+			for (uint32 i = 0; i < num_frames; ++i) {
+				const uint8 *start, *end;
+				if (store.acquire(i, &start, &end)) {
+					decoded.decode(i, start, end, ~0u);
+					store.release(i);
+				}
+			}
+		});
+
+		// and with half the tags off, which the decode skips like decode_masked
+		run(options, results, "decode_shared_masked" + suffix, options.reps, (double)w.num_quads, bytes, [&]() {
+			for (uint32 i = 0; i < num_frames; ++i) {
+				const uint8 *start, *end;
+				if (store.acquire(i, &start, &end)) {
+					decoded.decode(i, start, end, 0x3);
+					store.release(i);
+				}
+			}
+		});
+
+#ifdef BENCH_CAIRO
+		cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, kWidth, kHeight);
+		run(options, results, "render" + suffix, max(1, options.reps / 2), (double)w.num_quads, bytes, [&]() {
+			QuadBatch scratch;
+			for (uint32 i = 0; i < num_frames; ++i) {
+				const uint8 *start, *end;
+				if (store.acquire(i, &start, &end)) {
+					cairo_t *ctx = cairo_create(surface);
+					render_frame(ctx, 0, 0, kWidth, kHeight, start, end, ~0u, &scratch);
+					cairo_destroy(ctx);
+					store.release(i);
+				}
+			}
+			cairo_surface_flush(surface);
+		});
+		cairo_surface_destroy(surface);
+
+		// the exporter with its default worker count, from pushing the frame indices to the last
+		// frame written, so items per second is the export fps. raw frames to the null device
+		// leave the disk out of it
+		run(options, results, "export" + suffix, max(1, options.reps / 2), num_frames, bytes, [&]() {
+			FrameExporter exporter;
+			FrameExporter::Config config;
+#ifdef _WIN32
+			config.path = "NUL";
+#else
+			config.path = "/dev/null";
+#endif
+			config.format = FrameExporter::kFormatRaw;
+			config.width = kWidth;
+			config.height = kHeight;
+			if (!exporter.start(config, &store)) {
+				fprintf(stderr, "%s: unable to start the exporter\n", w.name);
+				return;
+			}
+			for (uint32 i = 0; i < num_frames; ++i)
+				exporter.push(i);
+			exporter.finish();
+			const FrameExporter::Stats stats = exporter.stats();
+			if (stats.written != num_frames)
+				fprintf(stderr, "%s: %u of %u frames exported, %u failed to write\n", w.name, stats.written, num_frames, stats.failed);
+		});
+
+		if (!selected(options, "surfaces4" + suffix))
+			return;
+
+		// an overview and three zoomed in views, each frame decoded once and drawn by all of them
+		vector<unique_ptr<OffscreenSurface> > surfaces;
+		const Viewport views[] = { Viewport(), Viewport(0, 0, 0.5f, 0.5f), Viewport(0.25f, 0.25f, 0.5f, 0.5f), Viewport(0.45f, 0.45f, 0.1f, 0.1f) };
+		for (int i = 0; i < 4; ++i) {
+			surfaces.push_back(unique_ptr<OffscreenSurface>(new OffscreenSurface(kWidth, kHeight)));
+			surfaces.back()->set_view(views[i]);
+			surfaces.back()->start();
+		}
+		DecodedFramePool pool;
+		run(options, results, "surfaces4" + suffix, max(1, options.reps / 2), (double)w.num_quads, bytes, [&]() {
+			for (uint32 i = 0; i < num_frames; ++i) {
+				const uint8 *start, *end;
+				if (store.acquire(i, &start, &end)) {
+					shared_ptr<DecodedFrame> decoded = pool.get();
+					decoded->decode(i, start, end, ~0u);
+					store.release(i);
+					for (size_t j = 0; j < surfaces.size(); ++j)
+						surfaces[j]->show(decoded);
+					for (size_t j = 0; j < surfaces.size(); ++j)
+						surfaces[j]->flush();
+				}
+			}
+		});
+#endif
+	}
+
+	void bench_transform(const Options &options, vector<Result> *results) {
+		const uint32 count = 4096;
+		Random rnd;
+		vector<uint8> buf(sizeof(log_msg::DrawQuads) + count * sizeof(log_msg::Quad));
+		log_msg::DrawQuads *q = new(&buf[0])log_msg::DrawQuads(count);
+		log_msg::Quad *quads = (log_msg::Quad *)(&buf[0] + sizeof(log_msg::DrawQuads));
+		for (uint32 i = 0; i < count; ++i)
+			quads[i] = log_msg::Quad(rnd.next(kWidth), rnd.next(kHeight), 1 + rnd.next(64), 1 + rnd.next(64), rnd.next());
+
+		const int iterations = 1000;
+		QuadBatch batch;
+		const ViewTransform xf(0.5f, 0.5f, 10, 20);
+		run(options, results, "transform/4096", options.reps, (double)count * iterations, (double)buf.size() * iterations, [&]() {
+			for (int i = 0; i < iterations; ++i)
+				transform_quads(q, xf, &batch);
+		});
+	}
+
+	void bench_timeline(const Options &options, vector<Result> *results) {
+		const char * const names[] = { "timeline_query/all", "timeline_query/100th", "timeline_query/frame" };
+		if (!any_selected(options, names, 3))
+			return;
+
+		// 8 threads, each with nested scopes 4 deep for about 10 seconds at 60 fps
+		Timeline timeline;
+		Random rnd;
+		const uint64_t frame_ns = 16666666;
+		uint64_t num_scopes = 0;
+		for (uint32 thread = 0; thread < 8; ++thread) {
+			uint64_t t = 0;
+			for (int frame = 0; frame < 600; ++frame) {
+				const uint64_t frame_end = t + frame_ns;
+				while (t + 100000 < frame_end) {
+					const uint64_t len = 1000 + rnd.next(200000);
+					timeline.begin_scope(thread, t, rnd.next() | 0xff);
+					for (int depth = 1; depth < 4; ++depth)
+						timeline.begin_scope(thread, t + depth * 10, rnd.next() | 0xff);
+					for (int depth = 3; depth > 0; --depth)
+						timeline.end_scope(thread, t + len - depth * 10);
+					timeline.end_scope(thread, t + len);
+					num_scopes += 4;
+					t += len + rnd.next(5000);
+				}
+				t = frame_end;
+			}
+		}
+
+		const uint64_t t0 = timeline.first_time(), t1 = timeline.last_time();
+		const uint64_t spans[] = { t1 - t0, (t1 - t0) / 100, frame_ns };
+		for (int i = 0; i < 3; ++i) {
+			const uint64_t span = spans[i];
+			const int queries = 100;
+			run(options, results, names[i], options.reps, queries, 0, [&]() {
+				vector<Timeline::Block> blocks;
+				for (int j = 0; j < queries; ++j) {
+					blocks.clear();
+					const uint64_t start = t0 + (t1 - t0 - span) * j / queries;
+					timeline.query(start, start + span, max<uint64_t>(1, span / kWidth), &blocks);
+				}
+			});
+		}
+	}
+
+#ifdef BENCH_CAIRO
+	// the startup cost of the font, parsing the .fnt and decoding the png against mapping the cache.
+	// both run with the files in the os cache, like any launch after the first
+	void bench_font(const Options &options, vector<Result> *results) {
+		const char * const names[] = { "font_load/parsed", "font_load/mapped" };
+		if (!any_selected(options, names, 2))
+			return;
+
+		const char *filename = options.font.c_str();
+		BmFont font;
+		if (!font.load(filename, false)) {
+			fprintf(stderr, "unable to load %s, skipping the font benchmarks\n", filename);
+			return;
+		}
+		run(options, results, "font_load/parsed", options.reps, 1, 0, [&]() {
+			font.load(filename, false);
+		});
+
+		// the first load writes the cache if it has to
+		font.load(filename);
+		if (!font.load(filename) || !font.from_cache()) {
+			fprintf(stderr, "unable to write the cache for %s, skipping font_load/mapped\n", filename);
+			return;
+		}
+		run(options, results, "font_load/mapped", options.reps, 1, 0, [&]() {
+			font.load(filename);
+		});
+	}
+#endif
+
+	string to_json(const Result &r) {
+		return to_string("{\"name\": \"%s\", \"median_ms\": %.4f, \"min_ms\": %.4f, \"items_per_sec\": %.0f, \"mb_per_sec\": %.1f}",
+			r.name.c_str(), r.median_ms, r.min_ms, r.items_per_sec, r.mb_per_sec);
+	}
+
+	// reads back the name and fastest time of each line written by to_json. the fastest run is what
+	// gets compared, since it's the one least disturbed by whatever else the machine is doing
+	bool load_baseline(const char *filename, map<string, double> *baseline) {
+		FILE *f = fopen(filename, "rt");
+		if (!f)
+			return false;
+		char line[1024], name[256];
+		double median, fastest;
+		while (fgets(line, sizeof(line), f)) {
+			if (sscanf(line, " {\"name\": \"%255[^\"]\", \"median_ms\": %lf, \"min_ms\": %lf", name, &median, &fastest) == 3)
+				(*baseline)[name] = fastest;
+		}
+		fclose(f);
+		return true;
+	}
+
+	void usage() {
+		fprintf(stderr,
+			"usage: log_server_bench [options]\n"
+			"  --reps <n>           runs per benchmark, the median is reported (default 7)\n"
+			"  --filter <str>       only run benchmarks whose name contains str\n"
+			"  --out <file>         also write the results to file\n"
+			"  --baseline <file>    compare against an earlier run, exit with 1 on regressions\n"
+			"  --threshold <frac>   allowed slowdown against the baseline (default 0.25)\n"
+			"  --write-baseline     write the results to the --baseline file instead of comparing\n"
+			"  --font <file>        the font for the font benchmarks (default ../lucida_console_16.fnt)\n");
+	}
+
+	bool parse_args(int argc, char **argv, Options *options) {
+		for (int i = 1; i < argc; ++i) {
+			const string arg = argv[i];
+			const bool has_value = i + 1 < argc;
+			if (arg == "--reps" && has_value)
+				options->reps = max(1, atoi(argv[++i]));
+			else if (arg == "--filter" && has_value)
+				options->filter = argv[++i];
+			else if (arg == "--out" && has_value)
+				options->out = argv[++i];
+			else if (arg == "--baseline" && has_value)
+				options->baseline = argv[++i];
+			else if (arg == "--threshold" && has_value)
+				options->threshold = atof(argv[++i]);
+			else if (arg == "--font" && has_value)
+				options->font = argv[++i];
+			else if (arg == "--write-baseline")
+				options->write_baseline = true;
+			else
+				return false;
+		}
+		return !options->write_baseline || !options->baseline.empty();
+	}
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!parse_args(argc, argv, &options)) {
+		usage();
+		return 2;
+	}
+
+	vector<Workload> workloads;
+	make_workloads(options, &workloads);
+
+	vector<Result> results;
+	for (size_t i = 0; i < workloads.size(); ++i)
+		bench_workload(workloads[i], options, &results);
+	bench_transform(options, &results);
+	bench_timeline(options, &results);
+#ifdef BENCH_CAIRO
+	bench_font(options, &results);
+#endif
+
+	string output;
+	for (size_t i = 0; i < results.size(); ++i)
+		output += to_json(results[i]) + "\n";
+	printf("%s", output.c_str());
+
+	if (!options.out.empty() && !save_file(options.out.c_str(), output.data(), output.size())) {
+		fprintf(stderr, "unable to write %s\n", options.out.c_str());
+		return 2;
+	}
+
+	if (options.baseline.empty())
+		return 0;
+
+	if (options.write_baseline) {
+		if (!save_file(options.baseline.c_str(), output.data(), output.size())) {
+			fprintf(stderr, "unable to write %s\n", options.baseline.c_str());
+			return 2;
+		}
+		return 0;
+	}
+
+	map<string, double> baseline;
+	if (!load_baseline(options.baseline.c_str(), &baseline)) {
+		// timings only compare on the machine that made them, so there's no shared baseline
+		fprintf(stderr, "no baseline in %s. write one on this machine first, with --write-baseline (make baseline)\n",
+			options.baseline.c_str());
+		return 2;
+	}
+
+	int regressions = 0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result &r = results[i];
+		auto it = baseline.find(r.name);
+		if (it == baseline.end() || it->second <= 0)
+			continue;
+		const double change = r.min_ms / it->second - 1;
+		const bool regressed = change > options.threshold;
+		fprintf(stderr, "%-32s %10.3f ms  baseline %10.3f ms  %+6.1f%%%s\n",
+			r.name.c_str(), r.min_ms, it->second, change * 100, regressed ? "  REGRESSION" : "");
+		regressions += regressed;
+	}
+
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,322 @@
+// Fuzzes the receive path: mutated messages go through validate_message and FrameAssembler
+// like in server_thread, and every frame that comes out is decoded the way the renderer does it.
+// Mutated frames are also fed to validate_frame directly.
+//
+// Frames are decoded from exactly sized heap copies, so building with -fsanitize=address
+// (make fuzz does) catches any read past the end that the validator let through.
+
+#include "stdafx.h"
+#include "log_messages.hpp"
+#include "frame_decoder.hpp"
+#include "frame_validator.hpp"
+#include "frame_assembler.hpp"
+#include "frame_store.hpp"
+#include "quad_transform.hpp"
+
+using namespace std;
+
+namespace {
+
+	typedef vector<uint8> Message;
+
+	struct Random {
+		Random(uint32 seed) : state(seed) {}
+		uint32 next() {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return state;
+		}
+		uint32 next(uint32 n) { return n ? next() % n : 0; }
+		uint32 state;
+	};
+
+	template <class T>
+	Message make_msg(const T &t) {
+		Message m(sizeof(T));
+		new(&m[0])T(t);
+		return m;
+	}
+
+	Message make_quads(Random *rnd, uint32 count) {
+		Message m(sizeof(log_msg::DrawQuads) + count * sizeof(log_msg::Quad));
+		new(&m[0])log_msg::DrawQuads(count, rnd->next(40));
+		log_msg::Quad *quads = (log_msg::Quad *)(&m[0] + sizeof(log_msg::DrawQuads));
+		for (uint32 i = 0; i < count; ++i)
+			quads[i] = log_msg::Quad(rnd->next(2000), rnd->next(2000), rnd->next(100), rnd->next(100), rnd->next());
+		return m;
+	}
+
+	// a well formed stream of messages, one frame (sometimes with nested ones) plus some scopes
+	void make_stream(Random *rnd, vector<Message> *out) {
+		out->push_back(make_msg(log_msg::BeginFrame()));
+		out->push_back(make_msg(log_msg::SetupWindow(1 + rnd->next(4000), 1 + rnd->next(4000))));
+		const uint32 batches = rnd->next(6);
+		for (uint32 i = 0; i < batches; ++i) {
+			out->push_back(make_quads(rnd, rnd->next(64)));
+			if (rnd->next(4) == 0) {
+				// a few nested frames, one after the other or inside each other
+				const uint32 nested = 1 + rnd->next(4);
+				const bool inside = rnd->next(2) == 0;
+				for (uint32 j = 0; j < nested; ++j) {
+					out->push_back(make_msg(log_msg::BeginFrame()));
+					out->push_back(make_quads(rnd, rnd->next(8)));
+					if (!inside)
+						out->push_back(make_msg(log_msg::EndFrame()));
+				}
+				for (uint32 j = 0; inside && j < nested; ++j)
+					out->push_back(make_msg(log_msg::EndFrame()));
+			}
+			if (rnd->next(4) == 0)
+				out->push_back(make_msg(log_msg::ScopeBegin(rnd->next(4), rnd->next(), rnd->next())));
+		}
+		out->push_back(make_msg(log_msg::EndFrame()));
+	}
+
+	void mutate(Random *rnd, Message *m) {
+		switch (rnd->next(8)) {
+			case 0:
+				// flip some bytes anywhere
+				for (uint32 i = 0, n = 1 + rnd->next(4); i < n && !m->empty(); ++i)
+					(*m)[rnd->next((uint32)m->size())] ^= (uint8)(1 << rnd->next(8));
+				break;
+
+			case 1:
+				// random command id, including ones past the end of the enum
+				if (m->size() >= sizeof(log_msg::Base))
+					((log_msg::Base *)&(*m)[0])->cmd = (log_msg::Cmd)(rnd->next(2) ? rnd->next(16) : rnd->next());
+				break;
+
+			case 2: {
+				// counts that are off by a little or a lot
+				if (m->size() >= sizeof(log_msg::DrawQuads) && ((log_msg::Base *)&(*m)[0])->cmd == log_msg::kCmdQuad) {
+					log_msg::DrawQuads *q = (log_msg::DrawQuads *)&(*m)[0];
+					const uint32 counts[] = { q->count + 1, q->count - 1, 0xffffffff, 0x80000000, 0x0ccccccd, rnd->next() };
+					q->count = counts[rnd->next(6)];
+				}
+				break;
+			}
+
+			case 3:
+				m->resize(rnd->next((uint32)m->size() + 1));
+				break;
+
+			case 4:
+				m->resize(m->size() + 1 + rnd->next(64), (uint8)rnd->next());
+				break;
+
+			case 5: {
+				// garbage
+				m->resize(rnd->next(64));
+				for (size_t i = 0; i < m->size(); ++i)
+					(*m)[i] = (uint8)rnd->next();
+				break;
+			}
+
+			default:
+				// most messages stay intact, so frames still get through
+				break;
+		}
+	}
+
+	// reads everything the renderer would
+	struct TouchingVisitor {
+		TouchingVisitor() : sum(0) {}
+		void setup_window(const log_msg::SetupWindow *s) {
+			xf.sx = 1000.0f / s->width;
+			xf.sy = 1000.0f / s->height;
+		}
+		void quads(const log_msg::DrawQuads *q) {
+			transform_quads(q, xf, &scratch);
+			for (uint32_t i = 0; i < scratch.count; ++i)
+				sum += scratch.x[i] + scratch.w[i] + scratch.color[i];
+		}
+		ViewTransform xf;
+		QuadBatch scratch;
+		double sum;
+	};
+
+	// adds the messages one at a time, and returns how many of them completed a frame. *frame
+	// is the last one
+	uint32 feed(FrameAssembler *assembler, const vector<Message> &msgs, uint32 *frame) {
+		uint32 completed = 0;
+		for (size_t i = 0; i < msgs.size(); ++i)
+			completed += assembler->add((const log_msg::Base *)&msgs[i][0], msgs[i].size(), frame);
+		return completed;
+	}
+
+	bool same_frame(FrameStore *store, uint32 frame, const vector<uint8> &expected) {
+		const uint8 *start, *end;
+		if (!store->acquire(frame, &start, &end))
+			return false;
+		const bool same = (size_t)(end - start) == expected.size() && !memcmp(start, &expected[0], expected.size());
+		store->release(frame);
+		return same;
+	}
+
+	// feeds the assembler clean frames until one comes out, which has to happen within
+	// kMaxNestedFrames + 1 of them whatever the mutated messages before left it in, and checks
+	// that it's exactly the frame that was sent. after that, a well formed frame with more
+	// nested frames one after the other than kMaxFrameDepth, and a chain of them exactly
+	// kMaxFrameDepth deep, has to come out whole, and only at its own EndFrame
+	bool check_recovers(Random *rnd, FrameAssembler *assembler, FrameStore *store) {
+		const Message begin = make_msg(log_msg::BeginFrame()), end = make_msg(log_msg::EndFrame());
+		uint32 frame;
+		bool recovered = false;
+		for (uint32 i = 0; i <= FrameAssembler::kMaxNestedFrames && !recovered; ++i) {
+			vector<Message> msgs;
+			msgs.push_back(begin);
+			msgs.push_back(make_msg(log_msg::SetupWindow(1 + rnd->next(4000), 1 + rnd->next(4000))));
+			msgs.push_back(make_quads(rnd, 1 + rnd->next(16)));
+			msgs.push_back(end);
+			if (!feed(assembler, msgs, &frame))
+				continue;
+
+			vector<uint8> expected(msgs[1]);
+			expected.insert(expected.end(), msgs[2].begin(), msgs[2].end());
+			if (!same_frame(store, frame, expected))
+				return false;
+			recovered = true;
+		}
+		if (!recovered)
+			return false;
+
+		vector<Message> msgs;
+		msgs.push_back(begin);
+		msgs.push_back(make_msg(log_msg::SetupWindow(1 + rnd->next(4000), 1 + rnd->next(4000))));
+		msgs.push_back(make_quads(rnd, 1 + rnd->next(16)));
+		vector<uint8> expected(msgs[1]);
+		expected.insert(expected.end(), msgs[2].begin(), msgs[2].end());
+		for (uint32 i = 0; i < 2 * FrameAssembler::kMaxFrameDepth; ++i) {
+			msgs.push_back(begin);
+			msgs.push_back(make_quads(rnd, 1 + rnd->next(4)));
+			msgs.push_back(end);
+		}
+		for (uint32 i = 0; i < FrameAssembler::kMaxFrameDepth; ++i) {
+			msgs.push_back(begin);
+			msgs.push_back(make_quads(rnd, 1 + rnd->next(4)));
+		}
+		for (uint32 i = 0; i < FrameAssembler::kMaxFrameDepth; ++i)
+			msgs.push_back(end);
+		msgs.push_back(make_quads(rnd, 1 + rnd->next(16)));
+		expected.insert(expected.end(), msgs.back().begin(), msgs.back().end());
+		msgs.push_back(end);
+
+		return feed(assembler, msgs, &frame) == 1 && same_frame(store, frame, expected);
+	}
+
+	double decode_copy(const uint8 *start, const uint8 *end) {
+		// exactly sized, so the sanitizer sees reads past the end
+		vector<uint8> copy(start, end);
+		TouchingVisitor v;
+		if (!copy.empty())
+			decode_frame(&copy[0], &copy[0] + copy.size(), ~0u, v);
+		return v.sum;
+	}
+}
+
+int main(int argc, char **argv) {
+	uint32 iterations = 100000;
+	uint32 seed = 1;
+	for (int i = 1; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "--iterations"))
+			iterations = (uint32)atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--seed"))
+			seed = (uint32)atoi(argv[i + 1]);
+	}
+
+	Random rnd(seed ? seed : 1);
+	FrameStore store;
+	FrameStore::Config config;
+	config.slab_size = 256 * 1024;
+	config.memory_budget = 1024 * 1024;
+	if (!store.init(config)) {
+		fprintf(stderr, "unable to create the frame store\n");
+		return 2;
+	}
+	FrameAssembler assembler(&store);
+
+	uint32 failures = 0, accepted = 0, rejected = 0, frames = 0, frames_validated = 0;
+	double sum = 0;
+	vector<Message> stream;
+
+	for (uint32 it = 0; it < iterations; ++it) {
+		stream.clear();
+		make_stream(&rnd, &stream);
+
+		// the validator has to accept everything that's well formed
+		for (size_t i = 0; i < stream.size(); ++i) {
+			if (!validate_message(&stream[i][0], stream[i].size())) {
+				fprintf(stderr, "iteration %u: well formed message %u rejected\n", it, (uint32)i);
+				failures++;
+			}
+		}
+
+		// whole frames, mutated as one buffer
+		{
+			vector<uint8> frame;
+			for (size_t i = 0; i < stream.size(); ++i) {
+				const log_msg::Cmd cmd = ((log_msg::Base *)&stream[i][0])->cmd;
+				if (cmd == log_msg::kCmdQuad || cmd == log_msg::kCmdSetupWindow)
+					frame.insert(frame.end(), stream[i].begin(), stream[i].end());
+			}
+			if (!frame.empty() && !validate_frame(&frame[0], &frame[0] + frame.size())) {
+				fprintf(stderr, "iteration %u: well formed frame rejected\n", it);
+				failures++;
+			}
+			mutate(&rnd, &frame);
+			if (frame.empty() || validate_frame(&frame[0], &frame[0] + frame.size())) {
+				frames_validated++;
+				sum += frame.empty() ? 0 : decode_copy(&frame[0], &frame[0] + frame.size());
+			}
+		}
+
+		// lose a message now and then, or get a stray frame marker
+		if (rnd.next(4) == 0) {
+			const size_t pos = rnd.next((uint32)stream.size());
+			if (rnd.next(2))
+				stream.erase(stream.begin() + pos);
+			else
+				stream.insert(stream.begin() + pos, rnd.next(2) ? make_msg(log_msg::BeginFrame()) : make_msg(log_msg::EndFrame()));
+		}
+
+		// and the receive path, one message at a time
+		for (size_t i = 0; i < stream.size(); ++i) {
+			// only some of them, or hardly any frame would survive
+			Message &m = stream[i];
+			if (rnd.next(8) == 0)
+				mutate(&rnd, &m);
+			if (!validate_message(m.empty() ? NULL : &m[0], m.size())) {
+				rejected++;
+				continue;
+			}
+			accepted++;
+
+			uint32 frame;
+			if (!assembler.add((const log_msg::Base *)&m[0], m.size(), &frame))
+				continue;
+
+			frames++;
+			const uint8 *start, *end;
+			if (!store.acquire(frame, &start, &end))
+				continue;
+			if (!validate_frame(start, end)) {
+				fprintf(stderr, "iteration %u: assembled frame %u doesn't validate\n", it, frame);
+				failures++;
+			} else {
+				sum += decode_copy(start, end);
+			}
+			store.release(frame);
+		}
+
+		// whatever the mutated frame markers did, clean frames have to get through again
+		if (it % 16 == 15 && !check_recovers(&rnd, &assembler, &store)) {
+			fprintf(stderr, "iteration %u: the assembler doesn't recover\n", it);
+			failures++;
+		}
+	}
+
+	printf("%u iterations, %u messages accepted, %u rejected, %u frames assembled, %u abandoned, %u mutated frames decoded, %u failures (%g)\n",
+		iterations, accepted, rejected, frames, assembler.num_abandoned(), frames_validated, failures, sum);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,45 @@
+#include "stdafx.h"
+#include "decoded_frame.hpp"
+#include "frame_decoder.hpp"
+
+namespace {
+	struct DecodeVisitor {
+		DecodeVisitor(DecodedFrame *out) : out(out), width(0), height(0) {}
+
+		void setup_window(const log_msg::SetupWindow *s) {
+			width = s->width;
+			height = s->height;
+		}
+
+		void quads(const log_msg::DrawQuads *q) {
+			DecodedFrame::Batch batch = { q->tag, out->quads.count, q->count, width, height };
+			out->batches.push_back(batch);
+			// kept in producer coordinates, the viewports are applied per surface
+			append_quads(q, ViewTransform(), &out->quads);
+		}
+
+		DecodedFrame *out;
+		int width, height;
+	};
+}
+
+void DecodedFrame::decode(uint32 frame, const uint8 *start, const uint8 *end, uint32_t tag_mask) {
+	this->frame = frame;
+	this->tag_mask = tag_mask;
+	batches.clear();
+	quads.resize(0);
+
+	DecodeVisitor v(this);
+	decode_frame(start, end, tag_mask, v);
+}
+
+std::shared_ptr<DecodedFrame> DecodedFramePool::get() {
+	// the references are only ever handed out from this thread, so if the pool holds the only one,
+	// nobody else can get it back
+	for (size_t i = 0; i < _frames.size(); ++i) {
+		if (_frames[i].use_count() == 1)
+			return _frames[i];
+	}
+	_frames.push_back(std::make_shared<DecodedFrame>());
+	return _frames.back();
+}
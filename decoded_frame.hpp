@@ -0,0 +1,52 @@
+#pragma once
+
+#include "quad_transform.hpp"
+
+// The part of the producer's window a surface shows, as fractions of the producer's size.
+// The default shows all of it.
+struct Viewport {
+	Viewport() : x(0), y(0), w(1), h(1) {}
+	Viewport(float x, float y, float w, float h) : x(x), y(y), w(w), h(h) {}
+
+	// the transform that puts this part of a producer window of producer_w * producer_h
+	// onto a target of target_w * target_h
+	ViewTransform transform(float producer_w, float producer_h, float target_w, float target_h) const {
+		const float sx = target_w / (w * producer_w);
+		const float sy = target_h / (h * producer_h);
+		return ViewTransform(sx, sy, -x * producer_w * sx, -y * producer_h * sy);
+	}
+
+	float x, y, w, h;
+};
+
+// A frame decoded once, in producer coordinates, and then shared read only by every surface that
+// shows it. Each surface only has to apply its own viewport. All surfaces show the same tags, so
+// the tag mask is applied here, and a frame has to be decoded again when it changes.
+struct DecodedFrame {
+	struct Batch {
+		uint32_t tag;
+		uint32_t first;   // index of the first quad in quads
+		uint32_t count;
+		// producer window size from the last SetupWindow before the batch, 0 if there wasn't one
+		int width, height;
+	};
+
+	DecodedFrame() : frame(0), tag_mask(~0u) {}
+	// decodes the (validated) commands in [start, end) of frame. batches whose tag isn't in
+	// tag_mask are skipped without being decoded
+	void decode(uint32 frame, const uint8 *start, const uint8 *end, uint32_t tag_mask);
+
+	uint32 frame;
+	uint32_t tag_mask;
+	std::vector<Batch> batches;
+	QuadBatch quads;
+};
+
+// Hands out decoded frames to decode into, reusing the ones no surface holds on to anymore, so big
+// frames don't reallocate their quads every time. Only for the thread that decodes.
+class DecodedFramePool {
+public:
+	std::shared_ptr<DecodedFrame> get();
+private:
+	std::vector<std::shared_ptr<DecodedFrame> > _frames;
+};
@@ -1,7 +1,14 @@
 #include "stdafx.h"
-#include <io.h>
 #include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include "file_utils.hpp"
+#include "string_utils.hpp"
 #include "utils.hpp"
 
 using namespace std;
@@ -20,6 +27,8 @@ string strip_extension(const char *str) {
 	return string(str, dot - str);
 }
 
+#ifdef _WIN32
+
 void split_path(const char *path, std::string *drive, std::string *dir, std::string *fname, std::string *ext) {
 	char drive_buf[_MAX_DRIVE];
 	char dir_buf[_MAX_DIR];
@@ -39,15 +48,39 @@ bool load_file(const char *filename, void **buf, size_t *size)
 	if (h.handle() == INVALID_HANDLE_VALUE)
 		return false;
 
-	*size = GetFileSize(h, NULL);
-	*buf = new uint8_t[*size];
+	const DWORD file_size = GetFileSize(h, NULL);
+	if (file_size == INVALID_FILE_SIZE)
+		return false;
+
+	unique_ptr<uint8_t[]> data(new uint8_t[file_size]);
 	DWORD res;
-	if (!ReadFile(h, *buf, *size, &res, NULL))
+	if (!ReadFile(h, data.get(), file_size, &res, NULL) || res != file_size)
 		return false;
 
+	*size = file_size;
+	*buf = data.release();
 	return true;
 }
 
+bool save_file(const char *filename, const void *buf, size_t size)
+{
+	ScopedHandle h(CreateFileA(filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+	if (h.handle() == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD res;
+	return WriteFile(h, buf, (DWORD)size, &res, NULL) && res == size;
+}
+
+bool save_file_replace(const char *filename, const void *buf, size_t size)
+{
+	const string tmp = to_string("%s.%u.tmp", filename, GetCurrentProcessId());
+	if (save_file(tmp.c_str(), buf, size) && MoveFileExA(tmp.c_str(), filename, MOVEFILE_REPLACE_EXISTING))
+		return true;
+	DeleteFileA(tmp.c_str());
+	return false;
+}
+
 bool file_exists(const char *filename)
 {
 	if (_access(filename, 0) != 0)
@@ -59,3 +92,277 @@ bool file_exists(const char *filename)
 
 	return !!(status.st_mode & _S_IFREG);
 }
+
+bool file_stamp(const char *filename, uint64_t *size, uint64_t *mtime)
+{
+	struct _stat64 status;
+	if (_stat64(filename, &status) != 0)
+		return false;
+
+	if (size) *size = status.st_size;
+	if (mtime) *mtime = status.st_mtime;
+	return true;
+}
+
+#else
+
+void split_path(const char *path, std::string *drive, std::string *dir, std::string *fname, std::string *ext) {
+	// there are no drives here, and the directory keeps its trailing slash like _splitpath
+	const char *slash = strrchr(path, '/');
+	const char *name = slash ? slash + 1 : path;
+	const char *dot = strrchr(name, '.');
+	if (drive) drive->clear();
+	if (dir) *dir = string(path, name - path);
+	if (fname) *fname = dot ? string(name, dot - name) : string(name);
+	if (ext) *ext = dot ? string(dot) : string();
+}
+
+bool load_file(const char *filename, void **buf, size_t *size)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f)
+		return false;
+	SCOPED_OBJ([&]() { fclose(f); });
+
+	struct stat status;
+	if (fstat(fileno(f), &status) != 0)
+		return false;
+
+	const size_t file_size = (size_t)status.st_size;
+	unique_ptr<uint8_t[]> data(new uint8_t[file_size]);
+	if (fread(data.get(), 1, file_size, f) != file_size)
+		return false;
+
+	*size = file_size;
+	*buf = data.release();
+	return true;
+}
+
+bool save_file(const char *filename, const void *buf, size_t size)
+{
+	FILE *f = fopen(filename, "wb");
+	if (!f)
+		return false;
+
+	const bool ok = fwrite(buf, 1, size, f) == size;
+	return fclose(f) == 0 && ok;
+}
+
+bool save_file_replace(const char *filename, const void *buf, size_t size)
+{
+	const string tmp = to_string("%s.%u.tmp", filename, (uint32)getpid());
+	if (save_file(tmp.c_str(), buf, size) && rename(tmp.c_str(), filename) == 0)
+		return true;
+	unlink(tmp.c_str());
+	return false;
+}
+
+bool file_exists(const char *filename)
+{
+	struct stat status;
+	if (stat(filename, &status) != 0)
+		return false;
+
+	return S_ISREG(status.st_mode);
+}
+
+bool file_stamp(const char *filename, uint64_t *size, uint64_t *mtime)
+{
+	struct stat status;
+	if (stat(filename, &status) != 0)
+		return false;
+
+	if (size) *size = status.st_size;
+	if (mtime) *mtime = status.st_mtime;
+	return true;
+}
+
+#endif
+
+MappedFile::MappedFile()
+	: _data(nullptr)
+	, _size(0)
+#ifdef _WIN32
+	, _file(INVALID_HANDLE_VALUE)
+	, _mapping(NULL)
+#else
+	, _fd(-1)
+#endif
+{
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char *filename, Access access)
+{
+	return open_range(filename, 0, 0, access);
+}
+
+#ifdef _WIN32
+
+size_t MappedFile::granularity()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwAllocationGranularity;
+}
+
+bool MappedFile::open_range(const char *filename, uint64_t offset, size_t size, Access access)
+{
+	close();
+
+	DWORD flags = FILE_ATTRIBUTE_NORMAL;
+	if (access == kAccessSequential)
+		flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+	else if (access == kAccessRandom)
+		flags |= FILE_FLAG_RANDOM_ACCESS;
+
+	// share write access, so files that are still being appended to can be mapped
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, flags, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	if (!map_range(file, offset, size, access)) {
+		CloseHandle(file);
+		return false;
+	}
+	_file = file;
+	return true;
+}
+
+bool MappedFile::map_range(HANDLE file, uint64_t offset, size_t size, Access access)
+{
+	// the access hint only goes to CreateFile, so there's nothing to do with it here
+	close();
+	Rollback rollback([this]() { close(); });
+
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size) || offset >= (uint64_t)file_size.QuadPart)
+		return false;
+
+	const uint64_t avail = file_size.QuadPart - offset;
+	if (size == 0) {
+		if (avail > (size_t)-1)
+			return false;
+		size = (size_t)avail;
+	} else if (size > avail) {
+		return false;
+	}
+
+	if (!(_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL)))
+		return false;
+
+	if (!(_data = (const uint8_t *)MapViewOfFile(_mapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset, size)))
+		return false;
+
+	_size = size;
+	rollback.commit();
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data)
+		UnmapViewOfFile(_data);
+	if (_mapping)
+		CloseHandle(_mapping);
+	if (_file != INVALID_HANDLE_VALUE)
+		CloseHandle(_file);
+	_data = nullptr;
+	_size = 0;
+	_mapping = NULL;
+	_file = INVALID_HANDLE_VALUE;
+}
+
+void MappedFile::prefetch(size_t offset, size_t len) const
+{
+	if (!_data || offset >= _size)
+		return;
+
+	// PrefetchVirtualMemory is Windows 8+, so look it up instead of linking against it
+	struct RangeEntry { void *addr; size_t size; };
+	typedef BOOL (WINAPI *PrefetchFn)(HANDLE, ULONG_PTR, RangeEntry *, ULONG);
+	static PrefetchFn prefetch_fn = (PrefetchFn)GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory");
+	if (!prefetch_fn)
+		return;
+
+	RangeEntry entry = { (void *)(_data + offset), min(len, _size - offset) };
+	prefetch_fn(GetCurrentProcess(), 1, &entry, 0);
+}
+
+#else
+
+size_t MappedFile::granularity()
+{
+	return (size_t)sysconf(_SC_PAGESIZE);
+}
+
+bool MappedFile::open_range(const char *filename, uint64_t offset, size_t size, Access access)
+{
+	close();
+
+	const int fd = ::open(filename, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	if (!map_range(fd, offset, size, access)) {
+		::close(fd);
+		return false;
+	}
+	_fd = fd;
+	return true;
+}
+
+bool MappedFile::map_range(int fd, uint64_t offset, size_t size, Access access)
+{
+	close();
+	Rollback rollback([this]() { close(); });
+
+	struct stat status;
+	if (fstat(fd, &status) != 0 || offset >= (uint64_t)status.st_size)
+		return false;
+
+	const uint64_t avail = status.st_size - offset;
+	if (size == 0)
+		size = (size_t)avail;
+	else if (size > avail)
+		return false;
+
+	void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, (off_t)offset);
+	if (data == MAP_FAILED)
+		return false;
+
+	_data = (const uint8_t *)data;
+	_size = size;
+	madvise(data, _size, access == kAccessSequential ? MADV_SEQUENTIAL : access == kAccessRandom ? MADV_RANDOM : MADV_NORMAL);
+	rollback.commit();
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (_data)
+		munmap((void *)_data, _size);
+	if (_fd != -1)
+		::close(_fd);
+	_data = nullptr;
+	_size = 0;
+	_fd = -1;
+}
+
+void MappedFile::prefetch(size_t offset, size_t len) const
+{
+	if (!_data || offset >= _size)
+		return;
+
+	// madvise wants a page aligned start
+	const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	const size_t start = offset & ~(page - 1);
+	const size_t end = offset + min(len, _size - offset);
+	madvise((void *)(_data + start), end - start, MADV_WILLNEED);
+}
+
+#endif
@@ -1,7 +1,61 @@
 #pragma once
 
+#include "utils.hpp"
+
 bool load_file(const char *filename, void **buf, size_t *size);
+bool save_file(const char *filename, const void *buf, size_t size);
+// writes a new file and renames it over filename, so whoever has the old one open or mapped
+// keeps seeing it whole
+bool save_file_replace(const char *filename, const void *buf, size_t size);
 bool file_exists(const char *filename);
+bool file_stamp(const char *filename, uint64_t *size, uint64_t *mtime);
 std::string replace_extension(const char *org, const char *new_ext);
 std::string strip_extension(const char *str);
 void split_path(const char *path, std::string *drive, std::string *dir, std::string *fname, std::string *ext);
+
+// Read-only view of a whole file. The mapping stays valid until close() or the
+// object is destroyed, so pointers into data() must not outlive it.
+class MappedFile {
+public:
+	enum Access {
+		kAccessNormal,
+		kAccessSequential,
+		kAccessRandom,
+	};
+
+#ifdef _WIN32
+	typedef HANDLE Handle;
+#else
+	typedef int Handle;
+#endif
+
+	MappedFile();
+	~MappedFile();
+	bool open(const char *filename, Access access = kAccessNormal);
+	// maps size bytes starting at offset, or the rest of the file if size is 0.
+	// offset must be a multiple of granularity()
+	bool open_range(const char *filename, uint64_t offset, size_t size, Access access = kAccessNormal);
+	// like open_range, but maps a file the caller already has open with read access, and keeps
+	// owning. the mapping doesn't need it to stay open
+	bool map_range(Handle file, uint64_t offset, size_t size, Access access = kAccessNormal);
+	void close();
+	static size_t granularity();
+
+	// hint that [offset, offset + len) will be read soon
+	void prefetch(size_t offset, size_t len) const;
+
+	bool is_open() const { return _data != nullptr; }
+	const uint8_t *data() const { return _data; }
+	size_t size() const { return _size; }
+private:
+	DISALLOW_COPY_AND_ASSIGN(MappedFile);
+
+	const uint8_t *_data;
+	size_t _size;
+#ifdef _WIN32
+	HANDLE _file;
+	HANDLE _mapping;
+#else
+	int _fd;
+#endif
+};
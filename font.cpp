@@ -0,0 +1,261 @@
+#include "stdafx.h"
+#include "font.hpp"
+#include "cairo/include/cairo/cairo.h"
+
+using namespace std;
+
+namespace {
+	const uint32_t kCacheMagic = 0x43464d42;   // 'CFMB'
+	const uint32_t kCacheVersion = 2;
+	const uint32_t kAtlasAlign = 16;
+
+	enum BlockType {
+		kBlockInfo = 1,
+		kBlockCommon = 2,
+		kBlockPages = 3,
+		kBlockChars = 4,
+		kBlockKerning = 5,
+	};
+
+#pragma pack(push, 1)
+	struct FntCommon {
+		uint16_t line_height;
+		uint16_t base;
+		uint16_t scale_w, scale_h;
+		uint16_t pages;
+		uint8_t bit_field;
+		uint8_t alpha_chnl, red_chnl, green_chnl, blue_chnl;
+	};
+
+	struct FntChar {
+		uint32_t id;
+		uint16_t x, y;
+		uint16_t width, height;
+		int16_t xoffset, yoffset;
+		int16_t xadvance;
+		uint8_t page;
+		uint8_t chnl;
+	};
+#pragma pack(pop)
+
+	string page_path(const char *fnt_filename, const char *page) {
+		string drive, dir;
+		split_path(fnt_filename, &drive, &dir, NULL, NULL);
+		return drive + dir + page;
+	}
+}
+
+#pragma pack(push, 1)
+struct BmFont::CacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t total_size;
+	// mtimes only have a resolution of a second, so the sizes are checked too
+	uint64_t fnt_mtime, fnt_size;
+	uint64_t png_mtime, png_size;
+	char page[64];
+	uint16_t line_height;
+	uint16_t base;
+	uint32_t atlas_format;
+	uint32_t atlas_width, atlas_height;
+	uint32_t atlas_stride;
+	uint32_t atlas_offset;
+	Glyph glyphs[kMaxGlyphs];
+};
+#pragma pack(pop)
+
+BmFont::BmFont()
+	: _header(nullptr)
+	, _atlas(nullptr)
+	, _from_cache(false)
+{
+}
+
+BmFont::~BmFont() {
+	close();
+}
+
+void BmFont::close() {
+	if (_atlas)
+		cairo_surface_destroy(exch_null(_atlas));
+	_header = nullptr;
+	_cache.close();
+	vector<uint8_t>().swap(_parsed);
+}
+
+bool BmFont::load(const char *filename, bool cache) {
+	close();
+
+	uint64_t fnt_size, fnt_mtime;
+	if (!file_stamp(filename, &fnt_size, &fnt_mtime))
+		return false;
+
+	const string cache_filename = replace_extension(filename, "fntc");
+	if (cache && _cache.open(cache_filename.c_str()) && use_cache(_cache.data(), _cache.size(), filename, fnt_size, fnt_mtime)) {
+		_from_cache = true;
+		return true;
+	}
+
+	close();
+	_from_cache = false;
+	if (!build_cache(filename, fnt_size, fnt_mtime, &_parsed))
+		return false;
+
+	// the next load gets to map it, but if the cache can't be written this one doesn't care.
+	// other processes may have the old one mapped, so it's replaced rather than rewritten
+	if (cache)
+		save_file_replace(cache_filename.c_str(), &_parsed[0], _parsed.size());
+	return use_cache(&_parsed[0], _parsed.size(), filename, fnt_size, fnt_mtime);
+}
+
+bool BmFont::use_cache(const uint8_t *data, size_t size, const char *fnt_filename, uint64_t fnt_size, uint64_t fnt_mtime) {
+	Rollback rollback([this]() { close(); });
+
+	const CacheHeader *header = (const CacheHeader *)data;
+	if (size < sizeof(CacheHeader) ||
+		header->magic != kCacheMagic || header->version != kCacheVersion ||
+		header->total_size != size || header->fnt_size != fnt_size || header->fnt_mtime != fnt_mtime)
+		return false;
+
+	if (header->atlas_offset % kAtlasAlign || (uint64_t)header->atlas_offset + (uint64_t)header->atlas_stride * header->atlas_height > size)
+		return false;
+
+	// the atlas is stale if the png has been touched since the cache was built
+	char page[sizeof(header->page) + 1] = { 0 };
+	memcpy(page, header->page, sizeof(header->page));
+	uint64_t png_size, png_mtime;
+	if (!file_stamp(page_path(fnt_filename, page).c_str(), &png_size, &png_mtime) ||
+		header->png_size != png_size || header->png_mtime != png_mtime)
+		return false;
+
+	if (header->atlas_format != CAIRO_FORMAT_ARGB32 && header->atlas_format != CAIRO_FORMAT_RGB24)
+		return false;
+
+	if (_cache.is_open())
+		_cache.prefetch(header->atlas_offset, header->atlas_stride * header->atlas_height);
+
+	// cairo only reads from source surfaces, so it's safe to hand it the cache data, even a read-only mapping
+	_atlas = cairo_image_surface_create_for_data((unsigned char *)data + header->atlas_offset,
+		(cairo_format_t)header->atlas_format, header->atlas_width, header->atlas_height, header->atlas_stride);
+	if (cairo_surface_status(_atlas) != CAIRO_STATUS_SUCCESS)
+		return false;
+
+	_header = header;
+	rollback.commit();
+	return true;
+}
+
+bool BmFont::build_cache(const char *fnt_filename, uint64_t fnt_size, uint64_t fnt_mtime, vector<uint8_t> *buf) {
+	MappedFile fnt;
+	if (!fnt.open(fnt_filename, MappedFile::kAccessSequential))
+		return false;
+
+	const uint8_t *ptr = fnt.data();
+	const uint8_t *end = ptr + fnt.size();
+	if (fnt.size() < 4 || memcmp(ptr, "BMF", 3) != 0 || ptr[3] != 3)
+		return false;
+	ptr += 4;
+
+	unique_ptr<CacheHeader> header(new CacheHeader);
+	memset(header.get(), 0, sizeof(CacheHeader));
+	header->magic = kCacheMagic;
+	header->version = kCacheVersion;
+	header->fnt_size = fnt_size;
+	header->fnt_mtime = fnt_mtime;
+
+	bool got_common = false, got_page = false;
+	while (end - ptr >= 5) {
+		const uint8_t type = ptr[0];
+		uint32_t size;
+		memcpy(&size, ptr + 1, sizeof(size));
+		ptr += 5;
+		if ((size_t)(end - ptr) < size)
+			return false;
+
+		switch (type) {
+			case kBlockCommon: {
+				if (size < sizeof(FntCommon))
+					return false;
+				const FntCommon *common = (const FntCommon *)ptr;
+				// only single page fonts are supported
+				if (common->pages != 1)
+					return false;
+				header->line_height = common->line_height;
+				header->base = common->base;
+				got_common = true;
+				break;
+			}
+
+			case kBlockPages: {
+				const size_t len = strnlen((const char *)ptr, size);
+				if (len == 0 || len >= sizeof(header->page))
+					return false;
+				memcpy(header->page, ptr, len);
+				got_page = true;
+				break;
+			}
+
+			case kBlockChars: {
+				for (uint32_t i = 0; i < size / sizeof(FntChar); ++i) {
+					const FntChar *c = (const FntChar *)ptr + i;
+					if (c->id >= kMaxGlyphs)
+						continue;
+					Glyph *g = &header->glyphs[c->id];
+					g->x = c->x; g->y = c->y;
+					g->width = c->width; g->height = c->height;
+					g->xoffset = c->xoffset; g->yoffset = c->yoffset;
+					g->xadvance = c->xadvance;
+					g->valid = 1;
+				}
+				break;
+			}
+
+			// info and kerning blocks aren't used (the fonts we ship are monospaced)
+		}
+		ptr += size;
+	}
+
+	if (!got_common || !got_page)
+		return false;
+
+	const string png_filename = page_path(fnt_filename, header->page);
+	if (!file_stamp(png_filename.c_str(), &header->png_size, &header->png_mtime))
+		return false;
+
+	cairo_surface_t *png = cairo_image_surface_create_from_png(png_filename.c_str());
+	SCOPED_OBJ([&]() { cairo_surface_destroy(png); });
+	if (cairo_surface_status(png) != CAIRO_STATUS_SUCCESS)
+		return false;
+
+	// both formats are 32 bits per pixel, so the pixels can be stored as-is
+	const cairo_format_t format = cairo_image_surface_get_format(png);
+	if (format != CAIRO_FORMAT_ARGB32 && format != CAIRO_FORMAT_RGB24)
+		return false;
+
+	cairo_surface_flush(png);
+	header->atlas_format = format;
+	header->atlas_width = cairo_image_surface_get_width(png);
+	header->atlas_height = cairo_image_surface_get_height(png);
+	header->atlas_stride = cairo_image_surface_get_stride(png);
+	header->atlas_offset = (sizeof(CacheHeader) + kAtlasAlign - 1) & ~(kAtlasAlign - 1);
+	header->total_size = header->atlas_offset + header->atlas_stride * header->atlas_height;
+
+	buf->resize(header->total_size);
+	memcpy(&(*buf)[0], header.get(), sizeof(CacheHeader));
+	memcpy(&(*buf)[header->atlas_offset], cairo_image_surface_get_data(png), header->atlas_stride * header->atlas_height);
+	return true;
+}
+
+const BmFont::Glyph *BmFont::glyph(uint32_t id) const {
+	if (!_header || id >= kMaxGlyphs || !_header->glyphs[id].valid)
+		return nullptr;
+	return &_header->glyphs[id];
+}
+
+int BmFont::line_height() const {
+	return _header ? _header->line_height : 0;
+}
+
+int BmFont::base() const {
+	return _header ? _header->base : 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "file_utils.hpp"
+
+struct _cairo_surface;
+
+// Loads an AngelCode BMFont (binary .fnt + single page atlas png).
+// The first load parses both files and writes a .fntc cache next to the .fnt; later
+// loads map the cache and use the glyph table and atlas pixels in place. If the cache
+// can't be written (a read-only install), the parsed data is used from memory instead.
+// Nothing in the server draws text yet, so only the benchmarks build this.
+class BmFont {
+public:
+	enum { kMaxGlyphs = 256 };
+
+#pragma pack(push, 1)
+	struct Glyph {
+		uint16_t x, y;
+		uint16_t width, height;
+		int16_t xoffset, yoffset;
+		int16_t xadvance;
+		uint16_t valid;
+	};
+#pragma pack(pop)
+
+	BmFont();
+	~BmFont();
+	// with cache false the font is always parsed, and the cache file isn't touched
+	bool load(const char *filename, bool cache = true);
+	void close();
+
+	const Glyph *glyph(uint32_t id) const;
+	int line_height() const;
+	int base() const;
+	struct _cairo_surface *atlas() const { return _atlas; }
+	bool from_cache() const { return _from_cache; }
+
+private:
+	DISALLOW_COPY_AND_ASSIGN(BmFont);
+
+	struct CacheHeader;
+	bool use_cache(const uint8_t *data, size_t size, const char *fnt_filename, uint64_t fnt_size, uint64_t fnt_mtime);
+	static bool build_cache(const char *fnt_filename, uint64_t fnt_size, uint64_t fnt_mtime, std::vector<uint8_t> *buf);
+
+	// the cache data is either mapped or, if it was just parsed, in memory
+	MappedFile _cache;
+	std::vector<uint8_t> _parsed;
+	const CacheHeader *_header;
+	struct _cairo_surface *_atlas;
+	bool _from_cache;
+};
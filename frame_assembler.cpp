@@ -0,0 +1,62 @@
+#include "stdafx.h"
+#include "frame_assembler.hpp"
+#include "frame_store.hpp"
+#include "log_messages.hpp"
+
+FrameAssembler::FrameAssembler(FrameStore *frames)
+	: _frames(frames)
+	, _frame_balance(0)
+	, _nested_frames(0)
+	, _abandoned(0)
+	, _skipping(false)
+{
+}
+
+bool FrameAssembler::add(const log_msg::Base *msg, size_t size, uint32 *frame) {
+	switch (msg->cmd) {
+
+		// handle frame markers
+		case log_msg::kCmdBeginFrame:
+			if (_frame_balance > kMaxFrameDepth || (_frame_balance > 0 && ++_nested_frames > kMaxNestedFrames)) {
+				// the outer frame lost its EndFrame, so drop it and start over with this one
+				_frame_balance = 0;
+				_abandoned++;
+			}
+			if (++_frame_balance != 1) {
+				// skip nested frames..
+				_skipping = true;
+			} else {
+				_nested_frames = 0;
+				_skipping = false;
+				_frames->begin_frame();
+			}
+			break;
+
+		case log_msg::kCmdEndFrame:
+			if (_frame_balance == 0) {
+				// not in a frame
+				break;
+			}
+			if (--_frame_balance != 0) {
+				// only the nested part is skipped, the outer frame picks up again here
+				_skipping = _frame_balance > 1;
+			} else {
+				*frame = _frames->end_frame();
+				return true;
+			}
+			break;
+
+		// handle render commands
+		case log_msg::kCmdQuad:
+		case log_msg::kCmdSetupWindow:
+			if (!_skipping)
+				_frames->append(msg, size);
+			break;
+
+		default:
+			// scopes are the caller's business, and nothing else makes it into a frame
+			break;
+	}
+
+	return false;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+class FrameStore;
+
+namespace log_msg {
+	struct Base;
+}
+
+// Turns the stream of received messages into frames in a FrameStore.
+// Draw commands outside of a frame are dropped. Nested frames are flattened into the outermost
+// one, and the draw commands of the nested part are dropped.
+//
+// Frame markers can get lost (a producer that dies mid frame, or a bad one), so an EndFrame
+// without a frame is ignored. A frame is taken to have lost its EndFrame, dropped, and started
+// over at the next BeginFrame when that BeginFrame would nest deeper than kMaxFrameDepth, or
+// when the frame already had kMaxNestedFrames nested frames. A lost EndFrame leaves every
+// following frame nested one deep, so it's the second limit that gets the stream going again.
+class FrameAssembler {
+public:
+	enum {
+		kMaxFrameDepth = 32,
+		kMaxNestedFrames = 1024,
+	};
+
+	FrameAssembler(FrameStore *frames);
+
+	// returns true if msg completed a frame, and sets *frame to its index
+	bool add(const log_msg::Base *msg, size_t size, uint32 *frame);
+
+	// frames that were dropped because they were never ended
+	uint32 num_abandoned() const { return _abandoned; }
+
+private:
+	FrameStore *_frames;
+	int _frame_balance;
+	// nested frames in the current frame, at any depth
+	uint32 _nested_frames;
+	uint32 _abandoned;
+	bool _skipping;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "log_messages.hpp"
+
+// Walks the draw commands of an assembled frame in [start, end), and calls
+// v.setup_window(const SetupWindow *) and v.quads(const DrawQuads *) for each of them.
+// Batches whose tag isn't in tag_mask are stepped over without being looked at.
+// This is the one decode loop, shared by everything that draws frames (and the benchmarks).
+// Nothing is checked here: the frame has to pass validate_frame, which everything assembled
+// from validated messages (so everything in a FrameStore) does.
+template <class Visitor>
+void decode_frame(const uint8 *start, const uint8 *end, uint32_t tag_mask, Visitor &v) {
+	const uint8 *ptr = start;
+	while (ptr != end) {
+		const log_msg::Base *b = (const log_msg::Base *)ptr;
+		switch (b->cmd) {
+
+			case log_msg::kCmdSetupWindow:
+				v.setup_window((const log_msg::SetupWindow *)b);
+				ptr += sizeof(log_msg::SetupWindow);
+				break;
+
+			case log_msg::kCmdQuad: {
+				const log_msg::DrawQuads *q = (const log_msg::DrawQuads *)b;
+				if (log_msg::tag_enabled(tag_mask, q->tag))
+					v.quads(q);
+				ptr += sizeof(log_msg::DrawQuads) + q->count * sizeof(log_msg::Quad);
+				break;
+			}
+
+			default:
+				// can't happen in a validated frame, and there's no telling how big it is
+				return;
+		}
+	}
+}
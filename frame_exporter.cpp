@@ -0,0 +1,299 @@
+#include "stdafx.h"
+#include <errno.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#include "frame_exporter.hpp"
+#include "frame_renderer.hpp"
+#include "frame_store.hpp"
+#include "quad_transform.hpp"
+#include "file_utils.hpp"
+#include "string_utils.hpp"
+#include "cairo/include/cairo/cairo.h"
+
+using namespace std;
+
+namespace {
+	cairo_status_t append_png_data(void *closure, const unsigned char *data, unsigned int length) {
+		vector<uint8> *buf = (vector<uint8> *)closure;
+		buf->insert(buf->end(), data, data + length);
+		return CAIRO_STATUS_SUCCESS;
+	}
+
+	double now_seconds() {
+#ifdef _WIN32
+		LARGE_INTEGER now, freq;
+		QueryPerformanceCounter(&now);
+		QueryPerformanceFrequency(&freq);
+		return (double)now.QuadPart / freq.QuadPart;
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+	}
+
+	int num_cores() {
+#ifdef _WIN32
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		return (int)info.dwNumberOfProcessors;
+#else
+		return max(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+#endif
+	}
+}
+
+FrameExporter::FrameExporter()
+	: _store(nullptr)
+#ifdef _WIN32
+	, _raw_file(INVALID_HANDLE_VALUE)
+#else
+	, _raw_file(-1)
+#endif
+	, _start_time(0)
+	, _in_flight(0)
+	, _next_seq(0)
+	, _next_write(0)
+	, _writing(false)
+	, _stopping(false)
+{
+}
+
+FrameExporter::~FrameExporter() {
+	finish();
+}
+
+bool FrameExporter::start(const Config &config, FrameStore *store) {
+	if (running() || !store || config.path.empty() || config.width <= 0 || config.height <= 0 || config.queue_size <= 0)
+		return false;
+
+	_config = config;
+	_store = store;
+#ifdef _WIN32
+	if (_config.format == kFormatPng) {
+		if (!CreateDirectoryA(_config.path.c_str(), NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+			return false;
+	} else if (_config.path == "-") {
+		_raw_file = GetStdHandle(STD_OUTPUT_HANDLE);
+	} else {
+		_raw_file = CreateFileA(_config.path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	}
+
+	if (_config.format == kFormatRaw && (_raw_file == INVALID_HANDLE_VALUE || _raw_file == NULL))
+		return false;
+#else
+	if (_config.format == kFormatPng) {
+		if (mkdir(_config.path.c_str(), 0777) != 0 && errno != EEXIST)
+			return false;
+	} else if (_config.path == "-") {
+		_raw_file = STDOUT_FILENO;
+	} else {
+		_raw_file = open(_config.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+
+	if (_config.format == kFormatRaw && _raw_file == -1)
+		return false;
+#endif
+
+	const int num_threads = _config.num_threads > 0 ? _config.num_threads : num_cores();
+
+	_queue.clear();
+	_in_flight = 0;
+	_next_seq = _next_write = 0;
+	_writing = _stopping = false;
+	_stats = Stats();
+	_start_time = now_seconds();
+
+	for (int i = 0; i < num_threads; ++i) {
+		unique_ptr<Thread> thread(new Thread);
+		if (thread->start(worker_thread, this))
+			_threads.push_back(move(thread));
+	}
+
+	return running();
+}
+
+bool FrameExporter::push(uint32 frame) {
+	if (!running())
+		return false;
+
+	// the frame stays in the store, so all that has to wait here is its index. this is the ui
+	// thread, so it never waits on the workers
+	SCOPED_CS(_cs);
+	_stats.pushed++;
+	if (_config.policy != kPolicyKeepAll && (int)_queue.size() >= _config.queue_size) {
+		_stats.dropped++;
+		if (_config.policy == kPolicyDropNewest)
+			return false;
+		_queue.pop_front();
+	}
+
+	_queue.push_back(frame);
+	_work_cv.wake_one();
+	return true;
+}
+
+void FrameExporter::finish() {
+	if (!running())
+		return;
+
+	// the workers drain the queue before they stop
+	{
+		SCOPED_CS(_cs);
+		_stopping = true;
+		_work_cv.wake_all();
+	}
+	_threads.clear();
+
+#ifdef _WIN32
+	if (_raw_file != INVALID_HANDLE_VALUE && _config.path != "-")
+		CloseHandle(_raw_file);
+	_raw_file = INVALID_HANDLE_VALUE;
+#else
+	if (_raw_file != -1 && _config.path != "-")
+		::close(_raw_file);
+	_raw_file = -1;
+#endif
+
+	_stats.seconds = now_seconds() - _start_time;
+	_store = nullptr;
+}
+
+FrameExporter::Stats FrameExporter::stats() {
+	SCOPED_CS(_cs);
+	return _stats;
+}
+
+void FrameExporter::worker_thread(void *data) {
+	((FrameExporter *)data)->worker_loop();
+}
+
+void FrameExporter::worker_loop() {
+	// each worker renders into its own surface
+	cairo_surface_t *surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, _config.width, _config.height);
+	SCOPED_OBJ([&]() { cairo_surface_destroy(surface); });
+	QuadBatch scratch;
+
+	while (true) {
+		Job *job = nullptr;
+		{
+			SCOPED_CS(_cs);
+			// backpressure is on the workers: they don't take new frames while too many encoded
+			// ones are waiting to be written
+			while (_queue.empty() ? !_stopping : _in_flight >= _config.queue_size)
+				_work_cv.wait(_cs);
+			if (_queue.empty())
+				break;
+			job = new Job;
+			job->frame = _queue.front();
+			_queue.pop_front();
+			_in_flight++;
+			// sequence numbers are handed out in queue order, which is the order frames get written
+			job->seq = _next_seq++;
+		}
+
+		encode(job, surface, &scratch);
+
+		{
+			SCOPED_CS(_cs);
+			_completed[job->seq] = job;
+		}
+		write_completed();
+	}
+}
+
+void FrameExporter::encode(Job *job, cairo_surface_t *surface, QuadBatch *scratch) {
+	// the frame is only pinned while it's rendered, spilled frames get mapped back in for it
+	const uint8 *start, *end;
+	job->rendered = _store->acquire(job->frame, &start, &end);
+	if (!job->rendered)
+		return;
+
+	cairo_t *ctx = cairo_create(surface);
+	cairo_set_source_rgb(ctx, 0, 0, 0);
+	cairo_paint(ctx);
+	// exports always keep every tag, so the artifacts are complete regardless of what's on screen
+	render_frame(ctx, 0, 0, _config.width, _config.height, start, end, ~0u, scratch);
+	cairo_destroy(ctx);
+	_store->release(job->frame);
+	cairo_surface_flush(surface);
+
+	if (_config.format == kFormatPng) {
+		cairo_surface_write_to_png_stream(surface, append_png_data, &job->encoded);
+	} else {
+		// strip the row padding so the stream is exactly width * height * 4 bytes per frame
+		const int row_size = _config.width * 4;
+		const int stride = cairo_image_surface_get_stride(surface);
+		const uint8 *src = cairo_image_surface_get_data(surface);
+		job->encoded.resize(row_size * _config.height);
+		for (int y = 0; y < _config.height; ++y)
+			memcpy(&job->encoded[y * row_size], src + y * stride, row_size);
+	}
+}
+
+bool FrameExporter::write(const Job *job) {
+#ifdef _WIN32
+	if (_config.format == kFormatPng) {
+		const string filename = to_string("%s\\frame_%06u.png", _config.path.c_str(), job->seq);
+		return save_file(filename.c_str(), job->encoded.empty() ? NULL : &job->encoded[0], job->encoded.size());
+	}
+
+	DWORD res;
+	return !!WriteFile(_raw_file, &job->encoded[0], (DWORD)job->encoded.size(), &res, NULL) && res == job->encoded.size();
+#else
+	if (_config.format == kFormatPng) {
+		const string filename = to_string("%s/frame_%06u.png", _config.path.c_str(), job->seq);
+		return save_file(filename.c_str(), job->encoded.empty() ? NULL : &job->encoded[0], job->encoded.size());
+	}
+
+	for (size_t done = 0; done < job->encoded.size(); ) {
+		const ssize_t res = ::write(_raw_file, &job->encoded[done], job->encoded.size() - done);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0)
+			return false;
+		done += (size_t)res;
+	}
+	return true;
+#endif
+}
+
+void FrameExporter::write_completed() {
+	// only one thread writes at a time, and it keeps going as long as the next frame in
+	// sequence is ready, so the workers never wait on each other's io
+	SCOPED_CS(_cs);
+	if (_writing)
+		return;
+	_writing = true;
+
+	while (true) {
+		auto it = _completed.find(_next_write);
+		if (it == _completed.end())
+			break;
+		Job *job = it->second;
+		_completed.erase(it);
+		_next_write++;
+
+		_cs.leave();
+		const bool rendered = job->rendered;
+		const bool ok = rendered && write(job);
+		delete job;
+		_cs.enter();
+
+		// a frame the store doesn't have anymore counts as dropped
+		if (!rendered)
+			_stats.dropped++;
+		else if (ok)
+			_stats.written++;
+		else
+			_stats.failed++;
+		_in_flight--;
+		_work_cv.wake_all();
+	}
+
+	_writing = false;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <deque>
+#include <map>
+#include "utils.hpp"
+
+struct QuadBatch;
+class FrameStore;
+
+// Dumps frames to a png sequence or a raw BGRX stream without stalling the render path.
+// push() only queues the frame's index. A pool of workers acquires each frame from the store,
+// re-renders it headless and encodes it, and the results are written out in the order they were queued.
+class FrameExporter {
+public:
+	enum Format {
+		kFormatPng,   // <path>/frame_000000.png, ..
+		kFormatRaw,   // width * height * 4 bytes per frame appended to <path>, or stdout if path is "-"
+	};
+
+	// what happens to pushed frames when the workers fall behind. push() never waits
+	enum Policy {
+		kPolicyKeepAll,     // the frames wait in the store until a worker gets to them
+		kPolicyDropNewest,  // frames pushed while queue_size are waiting are dropped
+		kPolicyDropOldest,  // the oldest waiting frame makes room
+	};
+
+	struct Config {
+		Config() : format(kFormatPng), policy(kPolicyKeepAll), width(640), height(480), queue_size(16), num_threads(0) {}
+		std::string path;
+		Format format;
+		Policy policy;
+		int width, height;
+		// how many frames can wait for a worker with the drop policies, and how many encoded
+		// frames can wait to be written before the workers stop taking new ones
+		int queue_size;
+		int num_threads;  // 0 = one per core
+	};
+
+	struct Stats {
+		Stats() : pushed(0), dropped(0), written(0), failed(0), seconds(0) {}
+		uint32 pushed;
+		uint32 dropped;
+		uint32 written;
+		uint32 failed;    // rendered, but couldn't be written (disk full, closed pipe)
+		double seconds;
+	};
+
+	FrameExporter();
+	~FrameExporter();
+	// the store has to outlive the export, frames are read from it until finish() returns
+	bool start(const Config &config, FrameStore *store);
+	// returns false if the frame was dropped
+	bool push(uint32 frame);
+	// waits for all queued frames to be written and stops the workers
+	void finish();
+	bool running() const { return !_threads.empty(); }
+	Stats stats();
+
+private:
+	DISALLOW_COPY_AND_ASSIGN(FrameExporter);
+
+	struct Job {
+		uint32 seq;
+		uint32 frame;
+		bool rendered;
+		std::vector<uint8> encoded;
+	};
+
+	static void worker_thread(void *data);
+	void worker_loop();
+	void encode(Job *job, struct _cairo_surface *surface, QuadBatch *scratch);
+	bool write(const Job *job);
+	void write_completed();
+
+	Config _config;
+	FrameStore *_store;
+#ifdef _WIN32
+	HANDLE _raw_file;
+#else
+	int _raw_file;
+#endif
+	std::vector<std::unique_ptr<Thread> > _threads;
+	double _start_time;
+
+	CriticalSection _cs;
+	ConditionVariable _work_cv;
+	std::deque<uint32> _queue;
+	std::map<uint32, Job *> _completed;
+	// frames picked up by a worker but not written yet, this is what holds the workers back
+	int _in_flight;
+	uint32 _next_seq;
+	uint32 _next_write;
+	bool _writing;
+	bool _stopping;
+	Stats _stats;
+};
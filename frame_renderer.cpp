@@ -0,0 +1,106 @@
+#include "stdafx.h"
+#include "frame_renderer.hpp"
+#include "frame_decoder.hpp"
+#include "quad_transform.hpp"
+#include "decoded_frame.hpp"
+#include "cairo/include/cairo/cairo.h"
+
+namespace {
+	void set_source_color(cairo_t *ctx, uint32_t col32) {
+#define MK_COL(x, shift) ((x >> shift) & 0xff) / 255.0
+		cairo_set_source_rgba(ctx, MK_COL(col32, 24), MK_COL(col32, 16), MK_COL(col32, 8), MK_COL(col32, 0));
+#undef MK_COL
+	}
+
+	struct CairoVisitor {
+		CairoVisitor(cairo_t *ctx, double x, double y, double width, double height, QuadBatch *scratch)
+			: ctx(ctx), width(width), height(height), xf(1, 1, (float)x, (float)y), scratch(scratch)
+			, first_time(true), prev_color(0), quads_remaining(false) {}
+
+		void setup_window(const log_msg::SetupWindow *s) {
+			// validated frames only have positive sizes
+			xf.sx = (float)(width / s->width);
+			xf.sy = (float)(height / s->height);
+		}
+
+		void quads(const log_msg::DrawQuads *q) {
+			transform_quads(q, xf, scratch);
+			const QuadBatch &batch = *scratch;
+			for (uint32_t i = 0; i < batch.count; ++i) {
+				const uint32_t col32 = batch.color[i];
+				if (first_time || col32 != prev_color) {
+					// draw the old stuff first
+					if (!first_time)
+						cairo_fill(ctx);
+					first_time = false;
+					set_source_color(ctx, col32);
+					prev_color = col32;
+					quads_remaining = true;
+				}
+				cairo_rectangle(ctx, batch.x[i], batch.y[i], batch.w[i], batch.h[i]);
+			}
+		}
+
+		cairo_t *ctx;
+		double width, height;
+		// producer -> target transform, replaced if the frame has a SetupWindow command
+		ViewTransform xf;
+		QuadBatch *scratch;
+
+		// only call fill when the previous color changes
+		bool first_time;
+		uint32_t prev_color;
+		bool quads_remaining;
+	};
+}
+
+void render_frame(cairo_t *ctx, double x, double y, double width, double height,
+	const uint8 *start, const uint8 *end, uint32_t tag_mask, QuadBatch *scratch) {
+
+	CairoVisitor v(ctx, x, y, width, height, scratch);
+	decode_frame(start, end, tag_mask, v);
+
+	if (v.quads_remaining)
+		cairo_fill(ctx);
+}
+
+void render_decoded_frame(cairo_t *ctx, double width, double height,
+	const DecodedFrame &frame, const Viewport &view) {
+
+	const float w = (float)width, h = (float)height;
+	const QuadBatch &quads = frame.quads;
+
+	bool first_time = true;
+	uint32_t prev_color = 0;
+
+	for (size_t i = 0; i < frame.batches.size(); ++i) {
+		const DecodedFrame::Batch &batch = frame.batches[i];
+
+		// without a SetupWindow, producer units are target pixels
+		const ViewTransform xf = batch.width ?
+			view.transform((float)batch.width, (float)batch.height, w, h) : view.transform(w, h, w, h);
+
+		for (uint32_t j = batch.first, last = batch.first + batch.count; j < last; ++j) {
+			const float x = xf.ox + quads.x[j] * xf.sx;
+			const float y = xf.oy + quads.y[j] * xf.sy;
+			const float qw = quads.w[j] * xf.sx;
+			const float qh = quads.h[j] * xf.sy;
+			// zoomed in views throw most of the quads away here
+			if (x >= w || y >= h || x + qw <= 0 || y + qh <= 0)
+				continue;
+
+			const uint32_t col32 = quads.color[j];
+			if (first_time || col32 != prev_color) {
+				if (!first_time)
+					cairo_fill(ctx);
+				first_time = false;
+				set_source_color(ctx, col32);
+				prev_color = col32;
+			}
+			cairo_rectangle(ctx, x, y, qw, qh);
+		}
+	}
+
+	if (!first_time)
+		cairo_fill(ctx);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+struct _cairo;
+struct QuadBatch;
+struct DecodedFrame;
+struct Viewport;
+
+// Draws the commands in [start, end) to ctx. Producer coordinates are scaled to the
+// rectangle at (x, y) of size width * height, using the frame's SetupWindow command if it has one.
+// Batches whose tag isn't in tag_mask are skipped without being decoded.
+// scratch is reused between calls to avoid reallocating the transformed quads.
+void render_frame(struct _cairo *ctx, double x, double y, double width, double height,
+	const uint8 *start, const uint8 *end, uint32_t tag_mask, QuadBatch *scratch);
+
+// Draws the part of a decoded frame in view to a target of width * height at the origin of ctx.
+// Quads that end up off the target are skipped.
+void render_decoded_frame(struct _cairo *ctx, double width, double height,
+	const DecodedFrame &frame, const Viewport &view);
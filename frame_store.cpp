@@ -0,0 +1,321 @@
+#include "stdafx.h"
+#include "frame_store.hpp"
+#include "string_utils.hpp"
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+FrameStore::FrameStore()
+	: _align(1)
+	, _cur_slab(nullptr)
+	, _frame_start(0)
+	, _in_frame(false)
+	, _next_spill(0)
+	, _memory_used(0)
+	, _spill_pending(0)
+	, _mapped_slab(~0u)
+	, _stopping(false)
+#ifdef _WIN32
+	, _spill_file(INVALID_HANDLE_VALUE)
+#else
+	, _spill_file(-1)
+#endif
+	, _spill_size(0)
+{
+}
+
+FrameStore::~FrameStore() {
+	close();
+}
+
+bool FrameStore::init(const Config &config) {
+	_config = config;
+
+	// spilled slabs are mapped back individually, so they have to start on a mapping boundary
+	_align = MappedFile::granularity();
+
+	_stopping = false;
+	if (!start_spilling())
+		return false;
+
+	_cur_slab = new_slab(0);
+	return true;
+}
+
+void FrameStore::close() {
+	stop_spilling();
+
+	for (size_t i = 0; i < _slabs.size(); ++i) {
+		delete [] _slabs[i]->mem;
+		delete _slabs[i];
+	}
+	_slabs.clear();
+	_frames.clear();
+	_spill_queue.clear();
+	_cur_slab = nullptr;
+	_next_spill = 0;
+	_memory_used = _spill_pending = 0;
+	_mapped_slab = ~0u;
+	_spill_size = 0;
+}
+
+#ifdef _WIN32
+
+bool FrameStore::open_spill_file() {
+	// the spill file is only used through our handle, and goes away with it. a name that's
+	// already taken is an error, rather than someone else's file to overwrite
+	DWORD creation = CREATE_NEW;
+	if (_config.spill_filename.empty()) {
+		char tmp[MAX_PATH], name[MAX_PATH];
+		// creates an empty file with a unique name
+		if (!GetTempPathA(MAX_PATH, tmp) || !GetTempFileNameA(tmp, "lss", 0, name))
+			return false;
+		_config.spill_filename = name;
+		creation = TRUNCATE_EXISTING;
+	}
+
+	_spill_file = CreateFileA(_config.spill_filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		creation, FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (_spill_file == INVALID_HANDLE_VALUE) {
+		if (creation == TRUNCATE_EXISTING)
+			DeleteFileA(_config.spill_filename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void FrameStore::close_spill_file() {
+	if (_spill_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(_spill_file);
+		_spill_file = INVALID_HANDLE_VALUE;
+	}
+}
+
+bool FrameStore::write_spill(const uint8 *data, size_t size, uint64_t offset) {
+	// a failed write may have moved the file pointer, so always seek to the end of the good data
+	LARGE_INTEGER pos;
+	pos.QuadPart = offset;
+	DWORD res;
+	return SetFilePointerEx(_spill_file, pos, NULL, FILE_BEGIN) &&
+		WriteFile(_spill_file, data, (DWORD)size, &res, NULL) && res == size;
+}
+
+#else
+
+bool FrameStore::open_spill_file() {
+	// a name that's already taken is an error, rather than someone else's file to overwrite
+	if (_config.spill_filename.empty()) {
+		const char *tmp = getenv("TMPDIR");
+		string name = string(tmp && *tmp ? tmp : "/tmp") + "/log_server_XXXXXX";
+		_spill_file = mkstemp(&name[0]);
+		_config.spill_filename = name;
+	} else {
+		_spill_file = open(_config.spill_filename.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	}
+	if (_spill_file == -1)
+		return false;
+
+	// the spill file is only used through our descriptor, and goes away with it
+	unlink(_config.spill_filename.c_str());
+
+	return true;
+}
+
+void FrameStore::close_spill_file() {
+	if (_spill_file != -1) {
+		::close(_spill_file);
+		_spill_file = -1;
+	}
+}
+
+bool FrameStore::write_spill(const uint8 *data, size_t size, uint64_t offset) {
+	while (size > 0) {
+		const ssize_t res = pwrite(_spill_file, data, size, (off_t)offset);
+		if (res <= 0)
+			return false;
+		data += res;
+		size -= res;
+		offset += res;
+	}
+	return true;
+}
+
+#endif
+
+bool FrameStore::start_spilling() {
+	return open_spill_file() && _spill_thread.start(spill_thread, this);
+}
+
+void FrameStore::stop_spilling() {
+	if (_spill_thread.running()) {
+		{
+			SCOPED_CS(_cs);
+			_stopping = true;
+			_spill_cv.wake_all();
+		}
+		_spill_thread.join();
+	}
+	close_spill_file();
+}
+
+void FrameStore::spill_thread(void *data) {
+	((FrameStore *)data)->spill_loop();
+}
+
+FrameStore::Slab *FrameStore::new_slab(size_t min_size) {
+	Slab *slab = new Slab;
+	slab->capacity = (max(_config.slab_size, 2 * min_size) + _align - 1) & ~(_align - 1);
+	slab->mem = new uint8[slab->capacity];
+
+	SCOPED_CS(_cs);
+	_slabs.push_back(slab);
+	_memory_used += slab->capacity;
+	return slab;
+}
+
+void FrameStore::begin_frame() {
+	// a frame that was never ended is dropped
+	if (_in_frame)
+		_cur_slab->used = _frame_start;
+	_in_frame = true;
+	_frame_start = _cur_slab->used;
+}
+
+void FrameStore::append(const void *data, size_t size) {
+	if (!_in_frame)
+		return;
+
+	// if the frame doesn't fit in the current slab, we move the frame to a new slab
+	if (_cur_slab->capacity - _cur_slab->used < size) {
+		const size_t frame_size = _cur_slab->used - _frame_start;
+		Slab *slab = new_slab(frame_size + size);
+		memcpy(slab->mem, _cur_slab->mem + _frame_start, frame_size);
+		slab->used = frame_size;
+		_cur_slab->used = _frame_start;
+		_cur_slab = slab;
+		_frame_start = 0;
+	}
+
+	memcpy(_cur_slab->mem + _cur_slab->used, data, size);
+	_cur_slab->used += size;
+}
+
+uint32 FrameStore::end_frame() {
+	_in_frame = false;
+
+	SCOPED_CS(_cs);
+	// the slab being filled is always the last one
+	FrameInfo info = { (uint32)_slabs.size() - 1, (uint32)_frame_start, (uint32)(_cur_slab->used - _frame_start) };
+	_frames.push_back(info);
+	queue_spills();
+	return (uint32)_frames.size() - 1;
+}
+
+void FrameStore::queue_spills() {
+	// never spill the slab that's being filled
+	while (_memory_used - _spill_pending > _config.memory_budget && _next_spill + 1 < _slabs.size()) {
+		_spill_pending += _slabs[_next_spill]->capacity;
+		_spill_queue.push_back(_next_spill++);
+		_spill_cv.wake_one();
+	}
+}
+
+void FrameStore::spill_loop() {
+	while (true) {
+		Slab *slab;
+		{
+			SCOPED_CS(_cs);
+			while (_spill_queue.empty() && !_stopping)
+				_spill_cv.wait(_cs);
+			if (_stopping)
+				break;
+			slab = _slabs[_spill_queue.front()];
+			_spill_queue.pop_front();
+		}
+
+		// the whole slab goes out in one write, padded so the next slab starts aligned too
+		const size_t write_size = (slab->used + _align - 1) & ~(_align - 1);
+		const bool ok = write_size == 0 || write_spill(slab->mem, write_size, _spill_size);
+
+		SCOPED_CS(_cs);
+		_spill_pending -= slab->capacity;
+		if (!ok) {
+			// keep it in memory, and stop spilling this slab
+#ifdef _WIN32
+			OutputDebugStringA(to_string("frame store: spill failed (%d)\n", GetLastError()).c_str());
+#else
+			fprintf(stderr, "frame store: spill failed (%s)\n", strerror(errno));
+#endif
+			continue;
+		}
+
+		slab->spill_offset = _spill_size;
+		slab->spilled = true;
+		_spill_size += write_size;
+		if (slab->pins == 0) {
+			delete [] exch_null(slab->mem);
+			_memory_used -= slab->capacity;
+		}
+	}
+}
+
+bool FrameStore::acquire(uint32 frame, const uint8 **start, const uint8 **end) {
+	SCOPED_CS(_cs);
+	if (frame >= _frames.size())
+		return false;
+
+	const FrameInfo &info = _frames[frame];
+	Slab *slab = _slabs[info.slab];
+	const uint8 *base = slab->mem;
+	if (!base && slab->used > 0) {
+		if (!slab->mapping.is_open()) {
+			// keep at most one unpinned spilled slab mapped, for stepping through old frames
+			if (_mapped_slab < _slabs.size() && _slabs[_mapped_slab]->pins == 0)
+				_slabs[_mapped_slab]->mapping.close();
+			if (!slab->mapping.map_range(_spill_file, slab->spill_offset, slab->used, MappedFile::kAccessRandom))
+				return false;
+			_mapped_slab = info.slab;
+		}
+		base = slab->mapping.data();
+	}
+
+	slab->pins++;
+	*start = base + info.offset;
+	*end = *start + info.size;
+	return true;
+}
+
+void FrameStore::release(uint32 frame) {
+	SCOPED_CS(_cs);
+	if (frame >= _frames.size())
+		return;
+
+	const uint32 idx = _frames[frame].slab;
+	Slab *slab = _slabs[idx];
+	if (--slab->pins > 0)
+		return;
+
+	if (slab->spilled && slab->mem) {
+		// the slab was spilled while it was pinned
+		delete [] exch_null(slab->mem);
+		_memory_used -= slab->capacity;
+	}
+
+	if (idx != _mapped_slab)
+		slab->mapping.close();
+}
+
+uint32 FrameStore::num_frames() {
+	SCOPED_CS(_cs);
+	return (uint32)_frames.size();
+}
+
+size_t FrameStore::memory_used() {
+	SCOPED_CS(_cs);
+	return _memory_used;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <deque>
+#include "utils.hpp"
+#include "file_utils.hpp"
+
+// Every received frame, addressed by a single frame index.
+//
+// Frames are assembled into large slabs in memory. When the slabs in memory go over the
+// budget, the oldest ones are handed to a spill thread that appends them to the spill file
+// with one sequential write per slab, and frees the memory. Spilled frames are mapped back
+// in on demand when they're acquired.
+//
+// begin_frame/append/end_frame are called from the receive thread only, and never wait on
+// the disk. acquire/release can be called from any thread.
+class FrameStore {
+public:
+	struct Config {
+		Config() : slab_size(10 * 1024 * 1024), memory_budget(256 * 1024 * 1024) {}
+		size_t slab_size;
+		size_t memory_budget;
+		// has to be a new file. empty picks a unique name in the temp directory
+		std::string spill_filename;
+	};
+
+	FrameStore();
+	~FrameStore();
+	bool init(const Config &config);
+	void close();
+
+	void begin_frame();
+	void append(const void *data, size_t size);
+	// returns the index of the completed frame
+	uint32 end_frame();
+
+	// the frame's data stays valid until it's released
+	bool acquire(uint32 frame, const uint8 **start, const uint8 **end);
+	void release(uint32 frame);
+
+	uint32 num_frames();
+	size_t memory_used();
+
+private:
+	DISALLOW_COPY_AND_ASSIGN(FrameStore);
+
+	struct Slab {
+		Slab() : mem(nullptr), capacity(0), used(0), spill_offset(0), spilled(false), pins(0) {}
+		uint8 *mem;         // null once spilled and unpinned
+		size_t capacity;
+		size_t used;
+		uint64_t spill_offset;
+		bool spilled;
+		int pins;
+		MappedFile mapping; // only open while a spilled slab is pinned
+	};
+
+	struct FrameInfo {
+		uint32 slab;
+		uint32 offset;
+		uint32 size;
+	};
+
+	static void spill_thread(void *data);
+	void spill_loop();
+	bool start_spilling();
+	void stop_spilling();
+	bool open_spill_file();
+	void close_spill_file();
+	bool write_spill(const uint8 *data, size_t size, uint64_t offset);
+
+	Slab *new_slab(size_t min_size);
+	void queue_spills();
+
+	Config _config;
+	size_t _align;
+
+	// receive thread state
+	Slab *_cur_slab;
+	size_t _frame_start;
+	bool _in_frame;
+
+	CriticalSection _cs;
+	ConditionVariable _spill_cv;
+	std::vector<Slab *> _slabs;
+	std::vector<FrameInfo> _frames;
+	std::deque<uint32> _spill_queue;
+	// the oldest slab that hasn't been queued for spilling yet
+	uint32 _next_spill;
+	size_t _memory_used;
+	// bytes queued for spilling but not written yet
+	size_t _spill_pending;
+	uint32 _mapped_slab;
+	bool _stopping;
+
+	Thread _spill_thread;
+#ifdef _WIN32
+	HANDLE _spill_file;
+#else
+	int _spill_file;
+#endif
+	uint64_t _spill_size;
+};
@@ -0,0 +1,70 @@
+#include "stdafx.h"
+#include "frame_validator.hpp"
+#include "log_messages.hpp"
+
+using namespace log_msg;
+
+namespace {
+	// size of the draw command at ptr, or 0 if it isn't a valid draw command that fits before end
+	size_t draw_command_size(const uint8 *ptr, const uint8 *end) {
+		const size_t avail = end - ptr;
+		if (avail < sizeof(Base))
+			return 0;
+
+		switch (((const Base *)ptr)->cmd) {
+
+			case kCmdSetupWindow: {
+				if (avail < sizeof(SetupWindow))
+					return 0;
+				const SetupWindow *s = (const SetupWindow *)ptr;
+				return s->width > 0 && s->height > 0 ? sizeof(SetupWindow) : 0;
+			}
+
+			case kCmdQuad: {
+				if (avail < sizeof(DrawQuads))
+					return 0;
+				// compare counts rather than sizes, so a huge count can't overflow
+				const uint32_t count = ((const DrawQuads *)ptr)->count;
+				if (count > (avail - sizeof(DrawQuads)) / sizeof(Quad))
+					return 0;
+				return sizeof(DrawQuads) + count * sizeof(Quad);
+			}
+
+			default:
+				return 0;
+		}
+	}
+}
+
+bool validate_message(const void *data, size_t size) {
+	if (size < sizeof(Base))
+		return false;
+
+	switch (((const Base *)data)->cmd) {
+		case kCmdBeginFrame: return size == sizeof(BeginFrame);
+		case kCmdEndFrame: return size == sizeof(EndFrame);
+		case kCmdScopeBegin: return size == sizeof(ScopeBegin);
+		case kCmdScopeEnd: return size == sizeof(ScopeEnd);
+
+		case kCmdSetupWindow:
+		case kCmdQuad: {
+			const uint8 *ptr = (const uint8 *)data;
+			return draw_command_size(ptr, ptr + size) == size;
+		}
+
+		default:
+			// commands the server doesn't draw (yet) are dropped too, the decoder would get stuck on them
+			return false;
+	}
+}
+
+bool validate_frame(const uint8 *start, const uint8 *end) {
+	const uint8 *ptr = start;
+	while (ptr != end) {
+		const size_t size = draw_command_size(ptr, end);
+		if (!size)
+			return false;
+		ptr += size;
+	}
+	return true;
+}
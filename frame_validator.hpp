@@ -0,0 +1,14 @@
+#pragma once
+
+// Checks for what comes in over the network, so nothing after the receive thread has to trust a producer.
+//
+// Every received message has to be exactly one known command of the right size, and a DrawQuads
+// count has to match the message size. Frames are assembled only from messages that passed, so the
+// decoder can walk them without any checks. Both checks are O(1) per command, the quads themselves
+// are never looked at.
+
+// true if the size bytes at data are one well formed message
+bool validate_message(const void *data, size_t size);
+
+// true if [start, end) is a sequence of well formed draw commands, i.e. something decode_frame can walk
+bool validate_frame(const uint8 *start, const uint8 *end);
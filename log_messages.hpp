@@ -1,6 +1,8 @@
 #pragma once
 #include <stdint.h>
+#ifndef LOG_SERVER_HEADLESS
 #include <zmq.hpp>
+#endif
 
 namespace log_msg {
 
@@ -16,8 +18,19 @@ namespace log_msg {
 		kCmdCircle,
 		kCmdLine,
 		kCmdEndFrame,
+		kCmdScopeBegin,
+		kCmdScopeEnd,
+		kCmdTagMask,
 	};
 
+	// Draw commands carry a tag in [0, kMaxTags) so whole categories can be hidden on the server.
+	// Commands with larger tags can't be filtered and are always drawn.
+	enum { kMaxTags = 32 };
+
+	inline bool tag_enabled(uint32_t mask, uint32_t tag) {
+		return tag >= kMaxTags || ((mask >> tag) & 1);
+	}
+
 	struct Quad {
 		Quad() {}
 		Quad(int x, int y, int width, int height, uint32_t color) : x(x), y(y), width(width), height(height), fill_color(color) {}
@@ -44,8 +57,9 @@ namespace log_msg {
 	};
 
 	struct DrawQuads : public Base {
-		DrawQuads(int count) : Base(kCmdQuad), count(count) {}
+		DrawQuads(int count, uint32_t tag = 0) : Base(kCmdQuad), count(count), tag(tag) {}
 		uint32_t count;
+		uint32_t tag;
 #pragma warning(suppress: 4200)
 		Quad quads[0];
 	};
@@ -55,6 +69,29 @@ namespace log_msg {
 
 	};
 
+	// Profiler scopes. These can be sent at any time, inside or outside of frames, and nest per thread_id.
+	// Timestamps are in nanoseconds, from any epoch as long as all producers share it.
+	struct ScopeBegin : public Base {
+		ScopeBegin(uint32_t thread_id, uint64_t timestamp, uint32_t color) : Base(kCmdScopeBegin), thread_id(thread_id), timestamp(timestamp), color(color) {}
+		uint32_t thread_id;
+		uint64_t timestamp;
+		uint32_t color;  // RGBA
+	};
+
+	struct ScopeEnd : public Base {
+		ScopeEnd(uint32_t thread_id, uint64_t timestamp) : Base(kCmdScopeEnd), thread_id(thread_id), timestamp(timestamp) {}
+		uint32_t thread_id;
+		uint64_t timestamp;
+	};
+
+	// Sent by the server (not the producers) on its tag mask port whenever the mask changes,
+	// and periodically so late subscribers catch up.
+	struct TagMask : public Base {
+		TagMask(uint32_t mask) : Base(kCmdTagMask), mask(mask) {}
+		uint32_t mask;
+	};
+
+#ifndef LOG_SERVER_HEADLESS
 	template <class T>
 	void send_msg(zmq::socket_t *socket, const T &t) {
 
@@ -63,17 +100,30 @@ namespace log_msg {
 		socket->send(msg);
 	}
 
-	inline void send_quads(zmq::socket_t *socket, const std::vector<log_msg::Quad> &quads) {
+	inline void send_quads(zmq::socket_t *socket, const std::vector<log_msg::Quad> &quads, uint32_t tag = 0) {
 		int count = quads.size();
 		int size = count * sizeof(log_msg::Quad);
 		zmq::message_t msg(sizeof(log_msg::DrawQuads) + size);
-		new(msg.data())log_msg::DrawQuads(count);
+		new(msg.data())log_msg::DrawQuads(count, tag);
 
 		void *dst = (void *)((uintptr_t)msg.data() + offsetof(log_msg::DrawQuads, quads));
 		memcpy(dst, &quads[0], size);
 		socket->send(msg);
 	}
 
+	// Drains pending TagMask messages from a ZMQ_SUB socket connected to the server's tag mask
+	// port, and returns the newest mask (or the old one if nothing arrived). Producers can then
+	// skip building and sending batches for tags the server doesn't want.
+	inline uint32_t poll_tag_mask(zmq::socket_t *socket, uint32_t mask) {
+		zmq::message_t msg;
+		while (socket->recv(&msg, ZMQ_NOBLOCK)) {
+			if (msg.size() == sizeof(TagMask) && ((TagMask *)msg.data())->cmd == kCmdTagMask)
+				mask = ((TagMask *)msg.data())->mask;
+		}
+		return mask;
+	}
+#endif
+
 
 #pragma pack(pop)
 }
@@ -3,13 +3,30 @@
 #include "window.hpp"
 #include "utils.hpp"
 #include "file_utils.hpp"
+#include "string_utils.hpp"
+#include "decoded_frame.hpp"
+#include "surface.hpp"
+#include "frame_exporter.hpp"
+#include "timeline.hpp"
+#include "frame_store.hpp"
+#include "frame_assembler.hpp"
+#include "frame_validator.hpp"
 #include "cairo/include/cairo/cairo.h"
 #include "cairo/include/cairo/cairo-win32.h"
 #include "log_messages.hpp"
 
+#include <windowsx.h>
+#include <math.h>
+
 #pragma comment(lib, "cairo/lib/cairo.lib")
 
 static const uint32 WM_NEW_FRAME = WM_APP + 1;
+static const UINT_PTR kTimelineTimer = 1;
+static const UINT_PTR kTagMaskTimer = 2;
+static const int kTimelineRowHeight = 12;
+static const int kTimelineLaneGap = 6;
+// narrowest view, in ns
+static const uint64_t kTimelineMinSpan = 1000;
 
 using namespace std;
 
@@ -19,12 +36,93 @@ struct ThreadConfig {
 	void *context;
 };
 
-struct NewFrameMsg {
-	NewFrameMsg(uint8 *start, uint8 *end) : start(start), end(end) {}
-	uint8 *start;
-	uint8 *end; // 1 byte past end
+static vector<string> split_args(const char *cmd_line) {
+	vector<string> args;
+	string cur;
+	for (const char *p = cmd_line; ; ++p) {
+		if (!*p || isspace((uint8)*p)) {
+			if (!cur.empty())
+				args.push_back(cur);
+			cur.clear();
+			if (!*p)
+				break;
+		} else {
+			cur += *p;
+		}
+	}
+	return args;
+}
+
+// -export <path> [-raw] [-drop | -drop-newest] [-threads n]
+// dumps every frame to a png sequence in <path>, or to a raw frame stream if -raw is given.
+// frames the export can't keep up with wait in the store, unless one of the -drop options is given
+static bool parse_export_args(const vector<string> &args, FrameExporter::Config *config) {
+	bool export_frames = false;
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (args[i] == "-export" && i + 1 < args.size()) {
+			config->path = args[++i];
+			export_frames = true;
+		} else if (args[i] == "-raw") {
+			config->format = FrameExporter::kFormatRaw;
+		} else if (args[i] == "-drop") {
+			config->policy = FrameExporter::kPolicyDropOldest;
+		} else if (args[i] == "-drop-newest") {
+			config->policy = FrameExporter::kPolicyDropNewest;
+		} else if (args[i] == "-threads" && i + 1 < args.size()) {
+			config->num_threads = atoi(args[++i].c_str());
+		}
+	}
+	return export_frames;
+}
+
+// -budget <mb> sets how much frame data is kept in memory, -spill <new file> where the rest goes
+static void parse_store_args(const vector<string> &args, FrameStore::Config *config) {
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (args[i] == "-budget" && i + 1 < args.size())
+			config->memory_budget = (size_t)atoi(args[++i].c_str()) * 1024 * 1024;
+		else if (args[i] == "-spill" && i + 1 < args.size())
+			config->spill_filename = args[++i];
+	}
+}
+
+// -tags <hex mask> sets the initial tag mask, -push-tags publishes it to the producers
+static void parse_tag_args(const vector<string> &args, uint32_t *mask, bool *push) {
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (args[i] == "-tags" && i + 1 < args.size())
+			*mask = strtoul(args[++i].c_str(), NULL, 16);
+		else if (args[i] == "-push-tags")
+			*push = true;
+	}
+}
+
+struct ViewConfig {
+	Viewport view;
+	uint32 min_interval_ms;
 };
 
+// -view <x,y,w,h[,fps]> opens another window showing that part of the producer's window (as
+// fractions of its size), drawing at most fps times a second
+static void parse_view_args(const vector<string> &args, vector<ViewConfig> *views) {
+	for (size_t i = 0; i < args.size(); ++i) {
+		if (args[i] != "-view" || i + 1 >= args.size())
+			continue;
+		ViewConfig v;
+		float fps = 0;
+		const int n = sscanf(args[++i].c_str(), "%f,%f,%f,%f,%f", &v.view.x, &v.view.y, &v.view.w, &v.view.h, &fps);
+		if (n < 4 || v.view.w <= 0 || v.view.h <= 0)
+			continue;
+		v.min_interval_ms = fps > 0 ? (uint32)(1000 / fps) : 0;
+		views->push_back(v);
+	}
+}
+
+// the views only show frames, and stay open as long as the main window does
+static LRESULT CALLBACK ViewWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
+	if (message == WM_CLOSE)
+		return 0;
+	return DefWindowProc(hWnd, message, wParam, lParam);
+}
+
 LRESULT CALLBACK LogServer::WndProc( HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam )
 {
 	static LogServer *self = nullptr;
@@ -36,13 +134,41 @@ LRESULT CALLBACK LogServer::WndProc( HWND hWnd, UINT message, WPARAM wParam, LPA
 			break;
 		}
 
-		case WM_NEW_FRAME: {
-			NewFrameMsg *msg = (NewFrameMsg *)wParam;
-			self->handle_new_frame_msg(msg);
-			delete msg;
+		case WM_NEW_FRAME:
+			self->handle_new_frame_msg((uint32)wParam);
+			break;
+
+		case WM_KEYDOWN:
+			if (wParam == 'T')
+				self->toggle_timeline();
+			else if (wParam == 'F')
+				self->fit_timeline();
+			else if (wParam >= '0' && wParam <= '9')
+				self->set_tag_mask(self->_tag_mask ^ (1 << (wParam - '0')));
+			else if (wParam == 'A')
+				self->set_tag_mask(~0u);
+			else if (wParam == VK_LEFT && self->_shown_frame > 0)
+				self->show_frame(self->_shown_frame - 1);
+			else if (wParam == VK_RIGHT)
+				self->show_frame(self->_shown_frame + 1);
+			else if (wParam == VK_END)
+				self->_live = true;
+			break;
+
+		case WM_MOUSEWHEEL: {
+			POINT pt = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+			ScreenToClient(hWnd, &pt);
+			self->zoom_timeline(GET_WHEEL_DELTA_WPARAM(wParam), pt.x);
 			break;
 		}
 
+		case WM_TIMER:
+			if (wParam == kTimelineTimer)
+				self->draw_timeline();
+			else if (wParam == kTagMaskTimer)
+				self->publish_tag_mask();
+			break;
+
 		case WM_DESTROY:
 			PostQuitMessage(0);
 			break;
@@ -51,64 +177,172 @@ LRESULT CALLBACK LogServer::WndProc( HWND hWnd, UINT message, WPARAM wParam, LPA
 	return DefWindowProc(hWnd, message, wParam, lParam);
 }
 
-void LogServer::handle_new_frame_msg(const NewFrameMsg *msg) {
+void LogServer::handle_new_frame_msg(uint32 frame) {
 
-	cairo_t *ctx = _cairo._context;
+	// new frames are exported even while stepping through old ones, the workers read them from the store
+	if (_exporter->running())
+		_exporter->push(frame);
 
-	// scale factors
-	double sx = 1, sy = 1;
-	double ox = _cairo.x1, oy = _cairo.y1;
+	const uint8 *start, *end;
+	if (!_frames->acquire(frame, &start, &end))
+		return;
 
-	// only call fill when the previous color changes
-	double pr = -1, pg = -1, pb = -1, pa = -1;
-	bool first_time = true;
-	bool quads_remaining = false;
-
-	uint8 *ptr = (uint8 *)msg->start;
-	while (ptr != msg->end) {
-		log_msg::Base *b = (log_msg::Base *)ptr;
-		switch (b->cmd) {
-
-			case log_msg::kCmdSetupWindow: {
-				log_msg::SetupWindow *s = (log_msg::SetupWindow *)b;
-				sx = s->width ? _cairo.width() / s->width : 1;
-				sy = s->height ? _cairo.height() / s->height : 1;
-				ptr += sizeof(log_msg::SetupWindow);
-				break;
-			}
+	// stepping through old frames keeps them on the surfaces. the main surface is paused while
+	// the timeline is up, and catches up when it closes
+	if (_live) {
+		show_on_surfaces(frame, start, end);
+		_shown_frame = frame;
+	}
 
-			case log_msg::kCmdQuad: {
-				log_msg::DrawQuads *q = (log_msg::DrawQuads *)b;
-				for (uint32_t i = 0; i < q->count; ++i) {
-					log_msg::Quad *cur = &q->quads[i];
-					uint32_t col32 = cur->fill_color;
-					double x = (double)cur->x;
-					double y = (double)cur->y;
-					double h = (double)cur->height;
-					double w = (double)cur->width;
-	#define MK_COL(x, shift) ((x >> shift) & 0xff) / 255.0f
-					double r = MK_COL(col32, 24), g = MK_COL(col32, 16), b = MK_COL(col32, 8), a = MK_COL(col32, 0);
-	#undef MK_COL
+	_frames->release(frame);
+}
 
-					const bool got_new_color = r != pr || g != pg || b != pb || a != pa;
-					if (first_time || got_new_color) {
-						// draw the old stuff first
-						if (!first_time)
-							cairo_fill(ctx);
-						first_time = false;
-						cairo_set_source_rgba(ctx, r, g, b, a);
-						pr = r; pg = g; pb = b; pa = a;
-						quads_remaining = true;
-					}
-					cairo_rectangle(ctx, ox + x * sx, oy + y * sy, w * sx, h * sy);
-				}
-				ptr += sizeof(log_msg::DrawQuads) + q->count * sizeof(log_msg::Quad);
-				break;
-			}
+void LogServer::show_frame(uint32 frame) {
+	if (_timeline_view.active || frame >= _frames->num_frames())
+		return;
+
+	// old frames may have been spilled, in which case acquire maps them back in
+	const uint8 *start, *end;
+	if (!_frames->acquire(frame, &start, &end))
+		return;
+
+	show_on_surfaces(frame, start, end);
+	_frames->release(frame);
+
+	_shown_frame = frame;
+	_live = false;
+}
+
+void LogServer::show_on_surfaces(uint32 frame, const uint8 *start, const uint8 *end) {
+	// decoded once, then each surface applies its own viewport on its own thread
+	shared_ptr<DecodedFrame> decoded = _decoded_frames->get();
+	decoded->decode(frame, start, end, _tag_mask);
+	for (size_t i = 0; i < _surfaces.size(); ++i)
+		_surfaces[i]->show(decoded);
+}
+
+void LogServer::set_tag_mask(uint32_t mask) {
+	_tag_mask = mask;
+
+	// hidden tags aren't decoded at all, so the frame on the surfaces is decoded again
+	const uint8 *start, *end;
+	if (_frames->acquire(_shown_frame, &start, &end)) {
+		show_on_surfaces(_shown_frame, start, end);
+		_frames->release(_shown_frame);
+	}
+	publish_tag_mask();
+}
+
+void LogServer::publish_tag_mask() {
+	if (!_zmq._tag_publisher)
+		return;
+
+	// a full send queue just means nobody is listening
+	zmq_msg_t msg;
+	zmq_msg_init_size(&msg, sizeof(log_msg::TagMask));
+	new(zmq_msg_data(&msg))log_msg::TagMask(_tag_mask);
+	zmq_send(_zmq._tag_publisher, &msg, ZMQ_NOBLOCK);
+	zmq_msg_close(&msg);
+}
+
+void LogServer::toggle_timeline() {
+	_timeline_view.active = !_timeline_view.active;
+	// the timeline is drawn on the ui thread, so the main surface has to stay off the window meanwhile
+	if (_timeline_view.active) {
+		_surfaces[0]->set_paused(true);
+		SetTimer(_window->hwnd(), kTimelineTimer, 33, NULL);
+		draw_timeline();
+	} else {
+		KillTimer(_window->hwnd(), kTimelineTimer);
+		_surfaces[0]->set_paused(false);
+	}
+}
+
+void LogServer::fit_timeline() {
+	SCOPED_CS(_timeline_cs);
+	_timeline_view.t0 = _timeline->first_time();
+	_timeline_view.t1 = _timeline->last_time();
+	_timeline_view.follow = true;
+}
+
+void LogServer::zoom_timeline(int wheel_delta, int x) {
+	if (!_timeline_view.active || wheel_delta == 0 || _timeline_view.t1 <= _timeline_view.t0)
+		return;
+
+	TimelineView &view = _timeline_view;
+	const double width = max(1.0, _cairo.width());
+	const double span = (double)(view.t1 - view.t0);
+	const double anchor = view.t0 + span * max(0.0, min(1.0, (x - _cairo.x1) / width));
+
+	// zoom in around the cursor, 20% per notch
+	const double scale = pow(0.8, (double)wheel_delta / WHEEL_DELTA);
+	const double new_span = max((double)kTimelineMinSpan, span * scale);
+	const double t0 = anchor - (anchor - view.t0) * new_span / span;
+	view.t0 = (uint64_t)max(0.0, t0);
+	view.t1 = view.t0 + (uint64_t)new_span;
+
+	SCOPED_CS(_timeline_cs);
+	view.follow = view.t1 >= _timeline->last_time();
+}
+
+void LogServer::draw_timeline() {
+	TimelineView &view = _timeline_view;
+	const double width = max(1.0, _cairo.width());
+
+	vector<Timeline::Block> blocks;
+	vector<int> lane_y;
+	int total_height = 0;
+	uint64_t ticks_per_pixel;
+	{
+		SCOPED_CS(_timeline_cs);
+		if (_timeline->empty())
+			return;
+
+		if (view.t1 <= view.t0) {
+			view.t0 = _timeline->first_time();
+			view.t1 = max(_timeline->last_time(), view.t0 + kTimelineMinSpan);
+		} else if (view.follow) {
+			const uint64_t span = view.t1 - view.t0;
+			view.t1 = max(_timeline->last_time(), span);
+			view.t0 = view.t1 - span;
+		}
+
+		ticks_per_pixel = max<uint64_t>(1, (uint64_t)((view.t1 - view.t0) / width));
+		_timeline->query(view.t0, view.t1, ticks_per_pixel, &blocks);
+
+		for (uint32_t i = 0; i < _timeline->num_lanes(); ++i) {
+			lane_y.push_back(total_height);
+			total_height += _timeline->num_rows(i) * kTimelineRowHeight + kTimelineLaneGap;
 		}
 	}
 
-	if (quads_remaining)
+	cairo_t *ctx = _cairo._context;
+	cairo_set_source_rgb(ctx, 0.1, 0.1, 0.1);
+	cairo_paint(ctx);
+
+	// blocks come out grouped by row, so only fill when the color changes like render_frame does
+	bool first_time = true;
+	uint32_t prev_color = 0;
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		const Timeline::Block &b = blocks[i];
+		const Timeline::Summary &s = b.summary;
+		const double x0 = s.start < view.t0 ? 0 : (double)(s.start - view.t0) / ticks_per_pixel;
+		const double x1 = s.end > view.t1 ? width : (double)(s.end - view.t0) / ticks_per_pixel;
+		const double y = _cairo.y1 + lane_y[b.lane] + b.depth * kTimelineRowHeight;
+
+		if (first_time || s.color != prev_color) {
+			if (!first_time)
+				cairo_fill(ctx);
+			first_time = false;
+	#define MK_COL(x, shift) ((x >> shift) & 0xff) / 255.0
+			cairo_set_source_rgba(ctx, MK_COL(s.color, 24), MK_COL(s.color, 16), MK_COL(s.color, 8), MK_COL(s.color, 0));
+	#undef MK_COL
+			prev_color = s.color;
+		}
+		cairo_rectangle(ctx, _cairo.x1 + x0, y, max(1.0, x1 - x0), kTimelineRowHeight - 1);
+	}
+
+	if (!first_time)
 		cairo_fill(ctx);
 }
 
@@ -122,16 +356,8 @@ DWORD WINAPI LogServer::server_thread(void *data) {
 	void *responder = zmq_socket(context, ZMQ_PULL);
 	zmq_bind(responder, "tcp://*:5555");
 
-	// create initial slab
-	int slab_size = 10 * 1024 * 1024;
-	self->_slabs.push_back(new uint8[slab_size]);
-	uint8 *cur_slab = self->_slabs.back();
-	int left = slab_size;
-
-	int frame_balance = 0;
-	bool skipping = false;
-	uint8 *start_ptr = cur_slab;
-	uint8 *cur_ptr = cur_slab;
+	FrameAssembler assembler(self->_frames.get());
+	uint32 rejected = 0;
 
 	while (true) {
 		zmq_msg_t request;
@@ -142,47 +368,37 @@ DWORD WINAPI LogServer::server_thread(void *data) {
 		int size = zmq_msg_size(&request);
 		log_msg::Base	*msg = (log_msg::Base	*)zmq_msg_data(&request);
 
+		// anyone who can reach the port can send us anything, so malformed messages stop here and
+		// nothing downstream checks again
+		if (!validate_message(msg, size)) {
+			if (rejected++ == 0)
+				OutputDebugStringA("server: dropping malformed messages\n");
+			zmq_msg_close(&request);
+			continue;
+		}
+
 		switch (msg->cmd) {
 
-			// handle frame markers
-			case log_msg::kCmdBeginFrame: {
-				if (++frame_balance != 1) {
-					// skip nested frames..
-					skipping = true;
-				} else {
-					start_ptr = cur_ptr;
-					log_msg::BeginFrame *f = static_cast<log_msg::BeginFrame *>(msg);
-				}
+			// profiler scopes go straight to the timeline, they're not part of any frame
+			case log_msg::kCmdScopeBegin: {
+				log_msg::ScopeBegin *b = static_cast<log_msg::ScopeBegin *>(msg);
+				SCOPED_CS(self->_timeline_cs);
+				self->_timeline->begin_scope(b->thread_id, b->timestamp, b->color);
 				break;
 			}
 
-			case log_msg::kCmdEndFrame: {
-				if (--frame_balance != 0) {
-					skipping = true;
-				} else {
-					log_msg::EndFrame *f = static_cast<log_msg::EndFrame *>(msg);
-					// report a completed frame
-					PostMessage(wnd, WM_NEW_FRAME, (WPARAM)new NewFrameMsg(start_ptr, cur_ptr), 0);
-				}
+			case log_msg::kCmdScopeEnd: {
+				log_msg::ScopeEnd *e = static_cast<log_msg::ScopeEnd *>(msg);
+				SCOPED_CS(self->_timeline_cs);
+				self->_timeline->end_scope(e->thread_id, e->timestamp);
 				break;
 			}
 
-			// handle render commands
-			case log_msg::kCmdQuad:
-			case log_msg::kCmdSetupWindow: {
-				if (!skipping) {
-					int req_size = zmq_msg_size(&request);
-					// if the frame doesn't fit in the current slab, we move the frame to a new slab
-					if (req_size > left) {
-						slab_size = max(slab_size, 2 * req_size);
-						self->_slabs.push_back(new uint8[slab_size]);
-						cur_slab = self->_slabs.back();
-						memcpy(cur_slab, start_ptr, cur_ptr - start_ptr);
-						start_ptr = cur_ptr = cur_slab;
-					}
-					memcpy(cur_ptr, msg, req_size);
-					cur_ptr += req_size;
-					left -= req_size;
+			default: {
+				uint32 frame;
+				if (assembler.add(msg, size, &frame)) {
+					// report a completed frame
+					PostMessage(wnd, WM_NEW_FRAME, (WPARAM)frame, 0);
 				}
 				break;
 			}
@@ -192,10 +408,22 @@ DWORD WINAPI LogServer::server_thread(void *data) {
 	}
 	zmq_close(responder);
 
+	if (rejected)
+		OutputDebugStringA(to_string("server: %u malformed messages dropped\n", rejected).c_str());
+	if (assembler.num_abandoned())
+		OutputDebugStringA(to_string("server: %u unfinished frames dropped\n", assembler.num_abandoned()).c_str());
+
 	return 0;
 }
 
 LogServer::LogServer()
+	: _decoded_frames(new DecodedFramePool)
+	, _exporter(new FrameExporter)
+	, _timeline(new Timeline)
+	, _tag_mask(~0u)
+	, _frames(new FrameStore)
+	, _shown_frame(0)
+	, _live(true)
 {
 }
 
@@ -216,7 +444,7 @@ void LogServer::Cairo::close() {
 	cairo_surface_destroy(_surface);
 }
 
-bool LogServer::init(HINSTANCE hInstance) {
+bool LogServer::init(HINSTANCE hInstance, const char *cmd_line) {
 
 	_window.reset(new Window(hInstance, 640, 480, "test", "test", &LogServer::WndProc));
 	if (!_window->create(this))
@@ -225,6 +453,44 @@ bool LogServer::init(HINSTANCE hInstance) {
 	if (!_cairo.init(_window->dc()))
 		return false;
 
+	const vector<string> args = split_args(cmd_line);
+
+	FrameStore::Config store_config;
+	parse_store_args(args, &store_config);
+	if (!_frames->init(store_config))
+		return false;
+
+	bool push_tags = false;
+	parse_tag_args(args, &_tag_mask, &push_tags);
+
+	_surfaces.push_back(unique_ptr<Surface>(new WindowSurface(_window->dc(), _window->width(), _window->height())));
+	if (!_surfaces[0]->start())
+		return false;
+
+	vector<ViewConfig> views;
+	parse_view_args(args, &views);
+	for (size_t i = 0; i < views.size(); ++i) {
+		const string name = to_string("view %d", (int)i + 1);
+		Window *window = new Window(hInstance, 640, 480, name, name, &ViewWndProc);
+		_view_windows.push_back(unique_ptr<Window>(window));
+		if (!window->create())
+			return false;
+
+		Surface *surface = new WindowSurface(window->dc(), window->width(), window->height());
+		_surfaces.push_back(unique_ptr<Surface>(surface));
+		surface->set_view(views[i].view);
+		if (!surface->start(views[i].min_interval_ms))
+			return false;
+	}
+
+	FrameExporter::Config export_config;
+	if (parse_export_args(args, &export_config)) {
+		export_config.width = _window->width();
+		export_config.height = _window->height();
+		if (!_exporter->start(export_config, _frames.get()))
+			return false;
+	}
+
 	ThreadConfig *config = new ThreadConfig();
 	config->wnd = _window->hwnd();
 
@@ -232,21 +498,43 @@ bool LogServer::init(HINSTANCE hInstance) {
 	config->context = _zmq._context = zmq_init(1);
 	_zmq._server_thread = CreateThread(NULL, 0, server_thread, config, 0, NULL);
 
+	// the tag mask goes out on its own socket, owned by the ui thread since that's where it changes
+	if (push_tags) {
+		_zmq._tag_publisher = zmq_socket(_zmq._context, ZMQ_PUB);
+		int linger = 0;
+		zmq_setsockopt(_zmq._tag_publisher, ZMQ_LINGER, &linger, sizeof(linger));
+		if (zmq_bind(_zmq._tag_publisher, "tcp://*:5556") != 0)
+			return false;
+		SetTimer(_window->hwnd(), kTagMaskTimer, 1000, NULL);
+		publish_tag_mask();
+	}
+
 	return true;
 }
 
 void LogServer::close() {
+	if (_zmq._tag_publisher)
+		zmq_close(exch_null(_zmq._tag_publisher));
 	zmq_term(_zmq._context);
 	WaitForSingleObject(_zmq._server_thread, INFINITE);
 	CloseHandle(_zmq._server_thread);
 	_zmq._server_thread = INVALID_HANDLE_VALUE;
+
+	_surfaces.clear();
+	if (_exporter->running()) {
+		_exporter->finish();
+		const FrameExporter::Stats stats = _exporter->stats();
+		OutputDebugStringA(to_string("export: %u frames written, %u dropped, %u failed to write, %.1f fps\n",
+			stats.written, stats.dropped, stats.failed, stats.seconds > 0 ? stats.written / stats.seconds : 0.0).c_str());
+	}
+	_frames->close();
 }
 
 
 int CALLBACK WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine, int nShowCmd) {
 
 	LogServer server;
-	if (!server.init(hInstance))
+	if (!server.init(hInstance, lpCmdLine))
 		return 1;
 
 	MSG msg = {0};
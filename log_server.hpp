@@ -1,9 +1,15 @@
 #pragma once
 
+#include "utils.hpp"
+
 class Window;
 class Graphics;
 class BmFont;
-struct NewFrameMsg;
+class Surface;
+class DecodedFramePool;
+class FrameExporter;
+class Timeline;
+class FrameStore;
 
 struct _cairo_surface;
 struct _cairo;
@@ -14,22 +20,58 @@ template <typename idx> class DynamicIb;
 class LogServer {
 public:
 	LogServer();
-	bool init(HINSTANCE hInstance);
+	bool init(HINSTANCE hInstance, const char *cmd_line);
 	void close();
 
 	static LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam );
 private:
-	void handle_new_frame_msg(const NewFrameMsg *msg);
+	void handle_new_frame_msg(uint32 frame);
+	void show_frame(uint32 frame);
+	void show_on_surfaces(uint32 frame, const uint8 *start, const uint8 *end);
+
+	void set_tag_mask(uint32_t mask);
+	void publish_tag_mask();
+
+	void toggle_timeline();
+	void fit_timeline();
+	void zoom_timeline(int wheel_delta, int x);
+	void draw_timeline();
 
 	static DWORD WINAPI server_thread(LPVOID data);
-	std::vector<uint8 *> _slabs;
 
 	std::unique_ptr<Window> _window;
+	// extra windows for the -view surfaces
+	std::vector<std::unique_ptr<Window> > _view_windows;
+	// the main window's surface first. frames are decoded once and handed to all of them
+	std::vector<std::unique_ptr<Surface> > _surfaces;
+	std::unique_ptr<DecodedFramePool> _decoded_frames;
+
+	std::unique_ptr<FrameExporter> _exporter;
+
+	// profiler scopes, written by the server thread and read by the ui
+	std::unique_ptr<Timeline> _timeline;
+	CriticalSection _timeline_cs;
+
+	struct TimelineView {
+		TimelineView() : active(false), follow(true), t0(0), t1(0) {}
+		bool active;
+		bool follow;  // keep the newest scopes in view
+		uint64_t t0, t1;
+	} _timeline_view;
+
+	// bit n set = draw commands with tag n are drawn
+	uint32_t _tag_mask;
+
+	std::unique_ptr<FrameStore> _frames;
+	// the frame on the surfaces. new frames only replace it while live
+	uint32 _shown_frame;
+	bool _live;
 
 	struct Zmq {
-		Zmq() : _server_thread(INVALID_HANDLE_VALUE), _context(nullptr) {}
+		Zmq() : _server_thread(INVALID_HANDLE_VALUE), _context(nullptr), _tag_publisher(nullptr) {}
 		HANDLE _server_thread;
 		void *_context;
+		void *_tag_publisher;
 	} _zmq;
 
 	struct Cairo {
@@ -0,0 +1,74 @@
+#include "stdafx.h"
+#include "quad_transform.hpp"
+#include "log_messages.hpp"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define QUAD_TRANSFORM_SSE2
+#endif
+
+void QuadBatch::resize(uint32_t new_count) {
+	count = new_count;
+	if (x.size() >= new_count)
+		return;
+
+	// grow with some slack so a frame full of similar batches doesn't keep reallocating
+	const size_t capacity = (new_count + new_count / 2 + 3) & ~3;
+	x.resize(capacity); y.resize(capacity); w.resize(capacity); h.resize(capacity);
+	color.resize(capacity);
+}
+
+// quads [first, last) of src go to the same indices of out, moved up by dst
+static void transform_quads_scalar(const log_msg::Quad *quads, uint32_t first, uint32_t last, const ViewTransform &xf, QuadBatch *out, uint32_t dst) {
+	for (uint32_t i = first; i < last; ++i) {
+		const log_msg::Quad &q = quads[i];
+		const uint32_t j = dst + i;
+		out->x[j] = xf.ox + (float)q.x * xf.sx;
+		out->y[j] = xf.oy + (float)q.y * xf.sy;
+		out->w[j] = (float)q.width * xf.sx;
+		out->h[j] = (float)q.height * xf.sy;
+		out->color[j] = q.fill_color;
+	}
+}
+
+static void transform_quads_at(const log_msg::DrawQuads *quads, const ViewTransform &xf, QuadBatch *out, uint32_t dst) {
+	const uint32_t count = quads->count;
+	const log_msg::Quad *src = quads->quads;
+
+	uint32_t i = 0;
+#ifdef QUAD_TRANSFORM_SSE2
+	const __m128 sx = _mm_set1_ps(xf.sx), sy = _mm_set1_ps(xf.sy);
+	const __m128 ox = _mm_set1_ps(xf.ox), oy = _mm_set1_ps(xf.oy);
+
+	// the quads are packed 20 byte structs, so gather 4 at a time into lanes and do the
+	// conversions and multiplies on whole registers
+	for (; i + 4 <= count; i += 4) {
+		const log_msg::Quad *q = &src[i];
+		const uint32_t j = dst + i;
+		const __m128i qx = _mm_setr_epi32(q[0].x, q[1].x, q[2].x, q[3].x);
+		const __m128i qy = _mm_setr_epi32(q[0].y, q[1].y, q[2].y, q[3].y);
+		const __m128i qw = _mm_setr_epi32(q[0].width, q[1].width, q[2].width, q[3].width);
+		const __m128i qh = _mm_setr_epi32(q[0].height, q[1].height, q[2].height, q[3].height);
+		const __m128i col = _mm_setr_epi32(q[0].fill_color, q[1].fill_color, q[2].fill_color, q[3].fill_color);
+
+		_mm_storeu_ps(&out->x[j], _mm_add_ps(ox, _mm_mul_ps(_mm_cvtepi32_ps(qx), sx)));
+		_mm_storeu_ps(&out->y[j], _mm_add_ps(oy, _mm_mul_ps(_mm_cvtepi32_ps(qy), sy)));
+		_mm_storeu_ps(&out->w[j], _mm_mul_ps(_mm_cvtepi32_ps(qw), sx));
+		_mm_storeu_ps(&out->h[j], _mm_mul_ps(_mm_cvtepi32_ps(qh), sy));
+		_mm_storeu_si128((__m128i *)&out->color[j], col);
+	}
+#endif
+
+	transform_quads_scalar(src, i, count, xf, out, dst);
+}
+
+void transform_quads(const log_msg::DrawQuads *quads, const ViewTransform &xf, QuadBatch *out) {
+	out->resize(quads->count);
+	transform_quads_at(quads, xf, out, 0);
+}
+
+void append_quads(const log_msg::DrawQuads *quads, const ViewTransform &xf, QuadBatch *out) {
+	const uint32_t first = out->count;
+	out->resize(first + quads->count);
+	transform_quads_at(quads, xf, out, first);
+}
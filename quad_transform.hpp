@@ -0,0 +1,29 @@
+#pragma once
+
+namespace log_msg {
+	struct DrawQuads;
+}
+
+// Maps producer coordinates to window coordinates (out = offset + in * scale).
+// Computed once per frame from the SetupWindow command.
+struct ViewTransform {
+	ViewTransform() : sx(1), sy(1), ox(0), oy(0) {}
+	ViewTransform(float sx, float sy, float ox, float oy) : sx(sx), sy(sy), ox(ox), oy(oy) {}
+	float sx, sy, ox, oy;
+};
+
+// Structure-of-arrays copy of a DrawQuads batch in window space.
+// color keeps the packed RGBA source color, so backends can detect color changes with a
+// single compare, and only convert it when it changes.
+struct QuadBatch {
+	QuadBatch() : count(0) {}
+	void resize(uint32_t count);
+
+	uint32_t count;
+	std::vector<float> x, y, w, h;
+	std::vector<uint32_t> color;
+};
+
+void transform_quads(const log_msg::DrawQuads *quads, const ViewTransform &xf, QuadBatch *out);
+// same, but adds the quads after the ones already in out
+void append_quads(const log_msg::DrawQuads *quads, const ViewTransform &xf, QuadBatch *out);
@@ -5,14 +5,30 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
+#endif
 
 #include <stdio.h>
+#ifdef _WIN32
 #include <tchar.h>
+#endif
 
+#ifndef LOG_SERVER_HEADLESS
 #include <zmq.h>
+#endif
 
+#ifdef _WIN32
 #include <Windows.h>
+#else
+// headless builds (the benchmarks) only get the parts of the server that don't need win32
+#include <pthread.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+using std::min;
+using std::max;
+#endif
 #include <stdint.h>
 
 #include <string>
@@ -1,20 +1,35 @@
 #include "stdafx.h"
 #include "string_utils.hpp"
+#include <stdarg.h>
+#ifndef _WIN32
+#include <alloca.h>
+#endif
 
 string to_string(char const * const fmt, ... ) 
 {
 	va_list arg;
 	va_start(arg, fmt);
 
+#ifdef _WIN32
 	const int len = _vscprintf(fmt, arg) + 1;
 
 	char* buf = (char*)_alloca(len);
 	vsprintf_s(buf, len, fmt, arg);
+#else
+	va_list arg_copy;
+	va_copy(arg_copy, arg);
+	const int len = vsnprintf(NULL, 0, fmt, arg_copy) + 1;
+	va_end(arg_copy);
+
+	char* buf = (char*)alloca(len);
+	vsnprintf(buf, len, fmt, arg);
+#endif
 	va_end(arg);
 
 	return string(buf);
 }
 
+#ifdef _WIN32
 bool wide_char_to_utf8(LPCOLESTR unicode, size_t len, string *str)
 {
 	if (!unicode)
@@ -55,6 +70,7 @@ wstring ansi_to_unicode(const char *str)
 
 	return res;
 }
+#endif
 
 bool begins_with(const char *str, const char *sub_str) {
 	const size_t len_a = strlen(str);
@@ -6,8 +6,10 @@ using std::wstring;
 
 string to_string(char const * const fmt, ... );
 string trim(const string &str);
+#ifdef _WIN32
 bool wide_char_to_utf8(LPCOLESTR unicode, size_t len, string *str);
 wstring ansi_to_unicode(const char *str);
+#endif
 
 bool begins_with(const char *str, const char *sub_str);
 
@@ -0,0 +1,208 @@
+#include "stdafx.h"
+#include "surface.hpp"
+#include "frame_renderer.hpp"
+#include "cairo/include/cairo/cairo.h"
+#ifdef _WIN32
+#include "cairo/include/cairo/cairo-win32.h"
+#endif
+
+using namespace std;
+
+Surface::Surface(int width, int height)
+	: _width(width)
+	, _height(height)
+	, _min_interval_ms(0)
+	, _dirty(false)
+	, _drawing(false)
+	, _paused(false)
+	, _stopping(false)
+{
+}
+
+Surface::~Surface() {
+	stop();
+}
+
+bool Surface::start(uint32 min_interval_ms) {
+	if (_thread.running())
+		return false;
+	_min_interval_ms = min_interval_ms;
+	_stopping = false;
+	return _thread.start(render_thread, this);
+}
+
+void Surface::stop() {
+	{
+		SCOPED_CS(_cs);
+		_stopping = true;
+		_work_cv.wake_all();
+		_stop_cv.wake_all();
+		_done_cv.wake_all();
+	}
+	_thread.join();
+}
+
+void Surface::show(const shared_ptr<const DecodedFrame> &frame) {
+	SCOPED_CS(_cs);
+	if (_pending)
+		_stats.skipped++;
+	_pending = frame;
+	_stats.shown++;
+	_work_cv.wake_one();
+}
+
+void Surface::set_view(const Viewport &view) {
+	SCOPED_CS(_cs);
+	_view = view;
+	_dirty = true;
+	_work_cv.wake_one();
+}
+
+void Surface::set_paused(bool paused) {
+	SCOPED_CS(_cs);
+	_paused = paused;
+	if (paused) {
+		while (_drawing)
+			_done_cv.wait(_cs);
+	} else {
+		// whoever had the target drew over us
+		_dirty = true;
+		_work_cv.wake_one();
+	}
+}
+
+bool Surface::idle() const {
+	return !_pending && !_dirty && !_drawing;
+}
+
+void Surface::flush() {
+	SCOPED_CS(_cs);
+	while (_thread.running() && !_paused && !_stopping && !idle())
+		_done_cv.wait(_cs);
+}
+
+Surface::Stats Surface::stats() {
+	SCOPED_CS(_cs);
+	return _stats;
+}
+
+void Surface::with_target(const function<void()> &fn) {
+	// the render thread only starts drawing while holding _cs, so once nothing is being drawn,
+	// holding it keeps the target to ourselves
+	SCOPED_CS(_cs);
+	while (_drawing)
+		_done_cv.wait(_cs);
+	fn();
+}
+
+void Surface::render_thread(void *data) {
+	((Surface *)data)->render_loop();
+}
+
+void Surface::render_loop() {
+	while (true) {
+		shared_ptr<const DecodedFrame> frame;
+		Viewport view;
+		{
+			SCOPED_CS(_cs);
+			while (!_stopping && (_paused || (!_pending && !_dirty)))
+				_work_cv.wait(_cs);
+			if (_stopping)
+				break;
+
+			if (_pending)
+				_current = move(_pending);
+			_dirty = false;
+			frame = _current;
+			view = _view;
+			_drawing = true;
+		}
+
+		// the frame is shared with the other surfaces, and only read here
+		cairo_t *ctx = frame ? begin_draw() : nullptr;
+		if (ctx) {
+			cairo_set_source_rgb(ctx, 0, 0, 0);
+			cairo_paint(ctx);
+			render_decoded_frame(ctx, _width, _height, *frame, view);
+			end_draw(ctx);
+		}
+
+		SCOPED_CS(_cs);
+		_drawing = false;
+		if (ctx)
+			_stats.drawn++;
+		_done_cv.wake_all();
+
+		if (_min_interval_ms && !_stopping)
+			_stop_cv.wait(_cs, _min_interval_ms);
+	}
+}
+
+OffscreenSurface::OffscreenSurface(int width, int height)
+	: Surface(width, height)
+	, _image(cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height))
+{
+}
+
+OffscreenSurface::~OffscreenSurface() {
+	stop();
+	cairo_surface_destroy(_image);
+}
+
+cairo_t *OffscreenSurface::begin_draw() {
+	return cairo_create(_image);
+}
+
+void OffscreenSurface::end_draw(cairo_t *ctx) {
+	cairo_destroy(ctx);
+	cairo_surface_flush(_image);
+}
+
+void OffscreenSurface::read_pixels(vector<uint8> *pixels) {
+	with_target([&]() {
+		// without the row padding
+		const int row_size = width() * 4;
+		const int stride = cairo_image_surface_get_stride(_image);
+		const uint8 *src = cairo_image_surface_get_data(_image);
+		pixels->resize(row_size * height());
+		for (int y = 0; y < height(); ++y)
+			memcpy(&(*pixels)[y * row_size], src + y * stride, row_size);
+	});
+}
+
+bool OffscreenSurface::save_png(const char *filename) {
+	bool ok = false;
+	with_target([&]() {
+		ok = cairo_surface_write_to_png(_image, filename) == CAIRO_STATUS_SUCCESS;
+	});
+	return ok;
+}
+
+#ifdef _WIN32
+
+WindowSurface::WindowSurface(HDC dc, int width, int height)
+	: Surface(width, height)
+	, _dc(dc)
+	, _target(nullptr)
+{
+}
+
+WindowSurface::~WindowSurface() {
+	stop();
+	if (_target)
+		cairo_surface_destroy(_target);
+}
+
+cairo_t *WindowSurface::begin_draw() {
+	// created on the render thread, which is the only one that draws with it
+	if (!_target && !(_target = cairo_win32_surface_create(_dc)))
+		return nullptr;
+	return cairo_create(_target);
+}
+
+void WindowSurface::end_draw(cairo_t *ctx) {
+	cairo_destroy(ctx);
+	cairo_surface_flush(_target);
+}
+
+#endif
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "utils.hpp"
+#include "decoded_frame.hpp"
+
+struct _cairo;
+struct _cairo_surface;
+
+// Somewhere frames get drawn, with its own viewport and its own render thread.
+//
+// show() only swaps in the newest decoded frame and wakes the thread, so it never waits on the
+// drawing. A surface that can't keep up draws the newest frame when it gets around to it and skips
+// the ones in between, without holding back the caller or the other surfaces.
+//
+// Subclasses provide the target. They have to call stop() in their destructor, before the target goes away.
+class Surface {
+public:
+	struct Stats {
+		Stats() : shown(0), drawn(0), skipped(0) {}
+		uint32 shown;
+		uint32 drawn;
+		uint32 skipped;   // replaced by a newer frame before they were drawn
+	};
+
+	Surface(int width, int height);
+	virtual ~Surface();
+
+	// min_interval_ms limits how often the surface draws, 0 draws every frame it gets to
+	bool start(uint32 min_interval_ms = 0);
+	void stop();
+
+	// any thread
+	void show(const std::shared_ptr<const DecodedFrame> &frame);
+	void set_view(const Viewport &view);
+
+	// while paused nothing is drawn, so someone else can use the target. pausing waits for
+	// a draw in progress to finish, and unpausing redraws the newest frame
+	void set_paused(bool paused);
+
+	// waits until everything passed to show has been drawn (or the surface is paused or stopped)
+	void flush();
+
+	Stats stats();
+	int width() const { return _width; }
+	int height() const { return _height; }
+
+protected:
+	// called on the render thread, around drawing each frame
+	virtual struct _cairo *begin_draw() = 0;
+	virtual void end_draw(struct _cairo *ctx) = 0;
+
+	// runs fn while no frame is being drawn
+	void with_target(const std::function<void()> &fn);
+
+private:
+	DISALLOW_COPY_AND_ASSIGN(Surface);
+
+	static void render_thread(void *data);
+	void render_loop();
+	bool idle() const;
+
+	int _width, _height;
+	uint32 _min_interval_ms;
+	Thread _thread;
+
+	CriticalSection _cs;
+	ConditionVariable _work_cv;   // something to draw, or stopping
+	ConditionVariable _done_cv;   // a draw finished
+	ConditionVariable _stop_cv;   // only for stopping, so the rate limit isn't cut short by new frames
+
+	std::shared_ptr<const DecodedFrame> _pending;  // newest frame, not drawn yet
+	std::shared_ptr<const DecodedFrame> _current;  // the frame on the target, redrawn if the view changes
+	Viewport _view;
+	bool _dirty;
+	bool _drawing;
+	bool _paused;
+	bool _stopping;
+	Stats _stats;
+};
+
+// Draws into an image in memory. Needs nothing but cairo, so it works headless.
+class OffscreenSurface : public Surface {
+public:
+	OffscreenSurface(int width, int height);
+	~OffscreenSurface();
+
+	// the last drawn image, as width * height * 4 bytes of cairo RGB24
+	void read_pixels(std::vector<uint8> *pixels);
+	bool save_png(const char *filename);
+
+protected:
+	virtual struct _cairo *begin_draw();
+	virtual void end_draw(struct _cairo *ctx);
+
+private:
+	struct _cairo_surface *_image;
+};
+
+#ifdef _WIN32
+// Draws straight into a window, through its (CS_OWNDC) device context.
+class WindowSurface : public Surface {
+public:
+	WindowSurface(HDC dc, int width, int height);
+	~WindowSurface();
+
+protected:
+	virtual struct _cairo *begin_draw();
+	virtual void end_draw(struct _cairo *ctx);
+
+private:
+	HDC _dc;
+	struct _cairo_surface *_target;
+};
+#endif
@@ -0,0 +1,142 @@
+#include "stdafx.h"
+#include "timeline.hpp"
+
+using namespace std;
+
+namespace {
+	void merge(Timeline::Summary *dst, const Timeline::Summary &src) {
+		dst->start = min(dst->start, src.start);
+		dst->end = max(dst->end, src.end);
+		dst->min_duration = min(dst->min_duration, src.min_duration);
+		if (src.max_duration > dst->max_duration) {
+			dst->max_duration = src.max_duration;
+			dst->color = src.color;
+		}
+		dst->count += src.count;
+	}
+}
+
+Timeline::Timeline()
+	: _first_time(~0ull)
+	, _last_time(0)
+{
+}
+
+void Timeline::clear() {
+	_lanes.clear();
+	_lane_by_thread.clear();
+	_first_time = ~0ull;
+	_last_time = 0;
+}
+
+Timeline::Lane *Timeline::lane(uint32_t thread_id) {
+	auto it = _lane_by_thread.find(thread_id);
+	if (it != _lane_by_thread.end())
+		return &_lanes[it->second];
+
+	_lane_by_thread[thread_id] = (uint32_t)_lanes.size();
+	_lanes.push_back(Lane());
+	_lanes.back().thread_id = thread_id;
+	return &_lanes.back();
+}
+
+void Timeline::begin_scope(uint32_t thread_id, uint64_t timestamp, uint32_t color) {
+	Lane *l = lane(thread_id);
+	if (l->open.size() >= kMaxDepth) {
+		l->dropped++;
+		return;
+	}
+
+	OpenScope scope = { timestamp, color };
+	l->open.push_back(scope);
+}
+
+void Timeline::end_scope(uint32_t thread_id, uint64_t timestamp) {
+	Lane *l = lane(thread_id);
+	if (l->dropped > 0) {
+		// the end of a scope that was too deep to keep
+		l->dropped--;
+		return;
+	}
+	if (l->open.empty())
+		return;
+
+	const OpenScope scope = l->open.back();
+	l->open.pop_back();
+
+	// scopes with a bogus end time are kept, but clamped to zero length
+	const uint64_t end = max(timestamp, scope.start);
+	const size_t depth = l->open.size();
+	if (l->rows.size() <= depth)
+		l->rows.resize(depth + 1);
+
+	Summary s = { scope.start, end, end - scope.start, end - scope.start, 1, scope.color };
+	l->rows[depth].append(s);
+
+	_first_time = min(_first_time, scope.start);
+	_last_time = max(_last_time, end);
+}
+
+void Timeline::Row::append(const Summary &scope) {
+	if (levels.empty())
+		levels.resize(1);
+	levels[0].push_back(scope);
+
+	// fold the new scope into its ancestor on every level above. once the top level gets a
+	// second node a new level is started, seeded with the old top node
+	for (size_t level = 1; levels[level - 1].size() > 1; ++level) {
+		if (levels.size() <= level) {
+			levels.resize(level + 1);
+			levels[level].push_back(levels[level - 1][0]);
+		}
+
+		const vector<Summary> &below = levels[level - 1];
+		vector<Summary> &cur = levels[level];
+		const size_t idx = (below.size() - 1) / kFanout;
+		if (idx == cur.size())
+			cur.push_back(scope);
+		else
+			merge(&cur[idx], scope);
+	}
+}
+
+void Timeline::Row::query(uint32_t level, size_t idx, uint64_t t0, uint64_t t1, uint64_t ticks_per_pixel, Block *tmpl, vector<Block> *out) const {
+	const Summary &node = levels[level][idx];
+	if (node.end < t0 || node.start > t1)
+		return;
+
+	if (level == 0 || node.end - node.start <= ticks_per_pixel) {
+		// neighbours that still fit in a pixel together are drawn as one block
+		Block *prev = out->empty() ? nullptr : &out->back();
+		if (prev && prev->lane == tmpl->lane && prev->depth == tmpl->depth && node.end - prev->summary.start <= ticks_per_pixel) {
+			merge(&prev->summary, node);
+		} else {
+			tmpl->summary = node;
+			out->push_back(*tmpl);
+		}
+		return;
+	}
+
+	const size_t first = idx * kFanout;
+	const size_t last = min(first + kFanout, levels[level - 1].size());
+	for (size_t i = first; i < last; ++i)
+		query(level - 1, i, t0, t1, ticks_per_pixel, tmpl, out);
+}
+
+void Timeline::query(uint64_t t0, uint64_t t1, uint64_t ticks_per_pixel, vector<Block> *out) const {
+	ticks_per_pixel = max<uint64_t>(ticks_per_pixel, 1);
+	for (size_t i = 0; i < _lanes.size(); ++i) {
+		const Lane &l = _lanes[i];
+		for (size_t j = 0; j < l.rows.size(); ++j) {
+			const Row &row = l.rows[j];
+			if (row.levels.empty())
+				continue;
+			Block tmpl;
+			tmpl.lane = (uint32_t)i;
+			tmpl.depth = (uint32_t)j;
+			const uint32_t top = (uint32_t)row.levels.size() - 1;
+			for (size_t k = 0; k < row.levels[top].size(); ++k)
+				row.query(top, k, t0, t1, ticks_per_pixel, &tmpl, out);
+		}
+	}
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <unordered_map>
+
+// Profiler scopes per thread, stored so that any time range can be drawn in O(pixels).
+//
+// Each thread gets a lane, and each nesting depth of a lane is a row. Scopes on one row never
+// overlap and arrive sorted, so every row keeps a pyramid of summaries: level 0 holds the
+// scopes themselves, and each node on level n summarizes kFanout nodes on level n-1.
+// A query walks down from the top and stops at the first node that fits in a pixel.
+// Scopes nested deeper than kMaxDepth are dropped.
+class Timeline {
+public:
+	enum { kFanout = 16, kMaxDepth = 64 };
+
+	// min/max/count summary of a run of consecutive scopes on one row
+	struct Summary {
+		uint64_t start;         // earliest start
+		uint64_t end;           // latest end
+		uint64_t min_duration;
+		uint64_t max_duration;
+		uint32_t count;
+		uint32_t color;         // color of the longest scope
+	};
+
+	struct Block {
+		uint32_t lane;
+		uint32_t depth;
+		Summary summary;
+	};
+
+	Timeline();
+	void begin_scope(uint32_t thread_id, uint64_t timestamp, uint32_t color);
+	void end_scope(uint32_t thread_id, uint64_t timestamp);
+	void clear();
+
+	// appends the blocks needed to draw [t0, t1] at ticks_per_pixel to out
+	void query(uint64_t t0, uint64_t t1, uint64_t ticks_per_pixel, std::vector<Block> *out) const;
+
+	bool empty() const { return _first_time > _last_time; }
+	uint64_t first_time() const { return _first_time; }
+	uint64_t last_time() const { return _last_time; }
+	uint32_t num_lanes() const { return (uint32_t)_lanes.size(); }
+	uint32_t num_rows(uint32_t lane) const { return (uint32_t)_lanes[lane].rows.size(); }
+
+private:
+	struct Row {
+		void append(const Summary &scope);
+		void query(uint32_t level, size_t idx, uint64_t t0, uint64_t t1, uint64_t ticks_per_pixel, Block *tmpl, std::vector<Block> *out) const;
+		std::vector<std::vector<Summary> > levels;
+	};
+
+	struct OpenScope {
+		uint64_t start;
+		uint32_t color;
+	};
+
+	struct Lane {
+		Lane() : thread_id(0), dropped(0) {}
+		uint32_t thread_id;
+		std::vector<OpenScope> open;
+		// begins past kMaxDepth that weren't kept, their ends are used up on these first
+		uint32_t dropped;
+		std::vector<Row> rows;
+	};
+
+	Lane *lane(uint32_t thread_id);
+
+	std::vector<Lane> _lanes;
+	std::unordered_map<uint32_t, uint32_t> _lane_by_thread;
+	uint64_t _first_time;
+	uint64_t _last_time;
+};
@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "utils.hpp"
 
+#ifdef _WIN32
+
 CriticalSection::CriticalSection() 
 {
 	InitializeCriticalSection(&_cs);
@@ -21,6 +23,178 @@ void CriticalSection::leave()
 	LeaveCriticalSection(&_cs);
 }
 
+ConditionVariable::ConditionVariable()
+{
+	InitializeConditionVariable(&_cv);
+}
+
+ConditionVariable::~ConditionVariable()
+{
+}
+
+bool ConditionVariable::wait(CriticalSection &cs, uint32 timeout_ms)
+{
+	return !!SleepConditionVariableCS(&_cv, &cs._cs, timeout_ms);
+}
+
+void ConditionVariable::wake_one()
+{
+	WakeConditionVariable(&_cv);
+}
+
+void ConditionVariable::wake_all()
+{
+	WakeAllConditionVariable(&_cv);
+}
+
+#else
+
+CriticalSection::CriticalSection()
+{
+	// critical sections are recursive, so keep that behaviour
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&_cs, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+CriticalSection::~CriticalSection()
+{
+	pthread_mutex_destroy(&_cs);
+}
+
+void CriticalSection::enter()
+{
+	pthread_mutex_lock(&_cs);
+}
+
+void CriticalSection::leave()
+{
+	pthread_mutex_unlock(&_cs);
+}
+
+ConditionVariable::ConditionVariable()
+{
+	pthread_cond_init(&_cv, NULL);
+}
+
+ConditionVariable::~ConditionVariable()
+{
+	pthread_cond_destroy(&_cv);
+}
+
+bool ConditionVariable::wait(CriticalSection &cs, uint32 timeout_ms)
+{
+	if (timeout_ms == ~0u)
+		return pthread_cond_wait(&_cv, &cs._cs) == 0;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout_ms / 1000;
+	ts.tv_nsec += (timeout_ms % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+	return pthread_cond_timedwait(&_cv, &cs._cs, &ts) == 0;
+}
+
+void ConditionVariable::wake_one()
+{
+	pthread_cond_signal(&_cv);
+}
+
+void ConditionVariable::wake_all()
+{
+	pthread_cond_broadcast(&_cv);
+}
+
+#endif
+
+#ifdef _WIN32
+
+Thread::Thread()
+	: _fn(nullptr)
+	, _arg(nullptr)
+	, _handle(NULL)
+{
+}
+
+bool Thread::start(Fn fn, void *arg)
+{
+	if (running())
+		return false;
+	_fn = fn;
+	_arg = arg;
+	return !!(_handle = CreateThread(NULL, 0, trampoline, this, 0, NULL));
+}
+
+void Thread::join()
+{
+	if (!_handle)
+		return;
+	WaitForSingleObject(_handle, INFINITE);
+	CloseHandle(_handle);
+	_handle = NULL;
+}
+
+bool Thread::running() const
+{
+	return _handle != NULL;
+}
+
+DWORD WINAPI Thread::trampoline(void *data)
+{
+	Thread *self = (Thread *)data;
+	self->_fn(self->_arg);
+	return 0;
+}
+
+#else
+
+Thread::Thread()
+	: _fn(nullptr)
+	, _arg(nullptr)
+	, _started(false)
+{
+}
+
+bool Thread::start(Fn fn, void *arg)
+{
+	if (running())
+		return false;
+	_fn = fn;
+	_arg = arg;
+	return _started = pthread_create(&_thread, NULL, trampoline, this) == 0;
+}
+
+void Thread::join()
+{
+	if (!_started)
+		return;
+	pthread_join(_thread, NULL);
+	_started = false;
+}
+
+bool Thread::running() const
+{
+	return _started;
+}
+
+void *Thread::trampoline(void *data)
+{
+	Thread *self = (Thread *)data;
+	self->_fn(self->_arg);
+	return NULL;
+}
+
+#endif
+
+Thread::~Thread()
+{
+	join();
+}
 
 ScopedCs::ScopedCs(CriticalSection &cs) 
 	: _cs(cs)
@@ -10,7 +10,28 @@ public:
 	void enter();
 	void leave();
 private:
+	friend class ConditionVariable;
+#ifdef _WIN32
 	CRITICAL_SECTION _cs;
+#else
+	pthread_mutex_t _cs;
+#endif
+};
+
+class ConditionVariable {
+public:
+	ConditionVariable();
+	~ConditionVariable();
+	// cs must be held by the caller, and is held again when wait returns. ~0 waits forever
+	bool wait(CriticalSection &cs, uint32 timeout_ms = ~0u);
+	void wake_one();
+	void wake_all();
+private:
+#ifdef _WIN32
+	CONDITION_VARIABLE _cv;
+#else
+	pthread_cond_t _cv;
+#endif
 };
 
 class ScopedCs {
@@ -21,6 +42,7 @@ private:
 	CriticalSection &_cs;
 };
 
+#ifdef _WIN32
 class ScopedHandle {
 public:
 	ScopedHandle(HANDLE h) : _h(h) {}
@@ -33,6 +55,7 @@ public:
 private:
 	HANDLE _h;
 };
+#endif
 
 struct ScopedObj
 {
@@ -69,6 +92,30 @@ struct Rollback {
 	TypeName(const TypeName&);               \
 	void operator=(const TypeName&)
 
+// A thread running fn(arg) until it returns. The destructor waits for it
+class Thread {
+public:
+	typedef void (*Fn)(void *arg);
+	Thread();
+	~Thread();
+	bool start(Fn fn, void *arg);
+	void join();
+	bool running() const;
+private:
+	DISALLOW_COPY_AND_ASSIGN(Thread);
+
+	Fn _fn;
+	void *_arg;
+#ifdef _WIN32
+	static DWORD WINAPI trampoline(void *data);
+	HANDLE _handle;
+#else
+	static void *trampoline(void *data);
+	pthread_t _thread;
+	bool _started;
+#endif
+};
+
 
 template< class Container >
 void safe_erase(Container& c, const typename Container::value_type& v)
@@ -80,14 +127,14 @@ void safe_erase(Container& c, const typename Container::value_type& v)
 
 template<class T> 
 void seq_delete(T* t) {
-	for (T::iterator it = t->begin(); it != t->end(); ++it)
+	for (typename T::iterator it = t->begin(); it != t->end(); ++it)
 		delete *it;
 	t->clear();
 }
 
 template<class T> 
 void assoc_delete(T* t) {
-	for (T::iterator it = t->begin(); it != t->end(); ++it)
+	for (typename T::iterator it = t->begin(); it != t->end(); ++it)
 		delete it->second;
 	t->clear();
 }
@@ -144,7 +191,7 @@ bool lookup(Key str, const std::unordered_map<Key, Value> &candidates, Value *re
 
 template<typename Container, typename Key>
 bool contains(const Container &c, const Key key) {
-	Container::const_iterator it = c.find(key);
+	typename Container::const_iterator it = c.find(key);
 	return it != c.end();
 }
 